@@ -1,9 +1,16 @@
 // [[Rcpp::plugins(cpp11)]]
 
 #include <Rcpp.h>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <queue>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <limits>
 #include "fasttext/fasttext.h"
 #include "fasttext/args.h"
 #include "main.h"
@@ -11,6 +18,39 @@
 using namespace Rcpp;
 using namespace fasttext;
 
+// Characters of an element of an R character vector, read in place
+static TextSpan text_span(const CharacterVector& texts, R_xlen_t i) {
+  SEXP text = STRING_ELT(texts, i);
+  return TextSpan{CHAR(text), static_cast<size_t>(LENGTH(text))};
+}
+
+// Read-only view on R character vectors, used to train without writing the documents to a file.
+// Only accessed from the main thread, while the corpus is built.
+class CharacterVectorSource : public DocumentSource {
+public:
+  CharacterVectorSource(const CharacterVector& documents, const CharacterVector& labels)
+    : documents_(documents), labels_(labels) {}
+
+  int64_t size() const override {
+    return documents_.size();
+  }
+
+  TextSpan text(int64_t i) const override {
+    return text_span(documents_, i);
+  }
+
+  TextSpan labels(int64_t i) const override {
+    if (labels_.size() == 0) {
+      return TextSpan{nullptr, 0};
+    }
+    return text_span(labels_, i);
+  }
+
+private:
+  const CharacterVector& documents_;
+  const CharacterVector& labels_;
+};
+
 class fastrtext{
 public:
 
@@ -22,12 +62,12 @@ public:
     model.reset();
   }
 
-  void load(const std::string path) {
+  void load(const std::string path, bool mmap, bool inference) {
     if(!std::ifstream(path)){
       stop("Path doesn't point to a file: " + path);
     }
     model.reset(new FastText);
-    model->loadModel(path);
+    model->loadModel(path, mmap, inference);
     model_loaded = true;
   }
 
@@ -58,30 +98,171 @@ public:
     std::Rcout << "" << std::endl;
   }
 
-  List predict(CharacterVector documents, int k = 1, real threshold = 0) {
+  void train(CharacterVector documents, CharacterVector labels, CharacterVector commands) {
+    if (labels.size() != 0 && labels.size() != documents.size()) {
+      stop("documents and labels should have the same length");
+    }
+    std::vector<std::string> args(commands.size());
+    for (R_xlen_t i = 0; i < commands.size(); ++i) {
+      args[i] = as<std::string>(commands[i]);
+    }
+    // fastText requires an input path, documents are provided in memory instead
+    args.push_back("-input");
+    args.push_back("<memory>");
+    Args a = Args();
+    a.parseArgs(args);
+    if (a.hasAutotune()) {
+      stop("Autotune is not supported when training from memory");
+    }
+    model.reset(new FastText);
+    model_loaded = false;
+    CharacterVectorSource source(documents, labels);
+    model->train(a, source);
+    model_loaded = true;
+    model->saveModel(a.output + ".bin");
+    model->saveVectors(a.output + (a.binaryVectors ? ".vecb" : ".vec"), a.binaryVectors, a.thread);
+    if (a.saveOutput) {
+      model->saveOutput(a.output + ".output");
+    }
+  }
+
+  List predict(CharacterVector documents, int k = 1, real threshold = 0, int nthreads = 1) {
     check_model_loaded();
-    List list(documents.size());
-    int label_prefix_size = model->getArgs().label.size();
-    std::string s;
-    for (int i = 0; i < documents.size(); ++i){
-      s = documents[i];
-      auto predictions = predict_proba(s, k, threshold);
-      NumericVector probabilitiesFasttext(predictions.size());
-      CharacterVector labels(predictions.size());
-      for (size_t j = 0; j < predictions.size() ; ++j){
-        probabilitiesFasttext[j] = predictions[j].first;
-        // remove label prefix
-        std::string label_without_prefix = predictions[j].second.erase(0, label_prefix_size);
-        labels[j] = label_without_prefix;
+    if (nthreads < 1) {
+      stop("nthreads should be 1 or higher");
+    }
+    const int32_t n_documents = documents.size();
+    std::vector<TextSpan> texts = as_spans(documents);
+    std::vector<Predictions> predictions(n_documents);
+    std::shared_ptr<const fasttext::Dictionary> dictionary = model->getDictionary();
+
+    // documents are scored by chunks, with one product by the output matrix per chunk
+    parallel_chunks(texts, nthreads, [&](int32_t begin, int32_t end, Model::BatchState& batch,
+                                               std::vector<std::vector<int32_t>>& inputs) {
+      std::vector<Predictions> chunk_predictions;
+      model->predict(k, inputs, chunk_predictions, batch, threshold);
+      for (int32_t i = begin; i < end; ++i) {
+        predictions[i] = std::move(chunk_predictions[i - begin]);
+      }
+    });
+
+    std::vector<std::string> label_names = get_label_names();
+    List list(n_documents);
+    for (int32_t i = 0; i < n_documents; ++i) {
+      const Predictions& document_predictions = predictions[i];
+      NumericVector probabilities(document_predictions.size());
+      CharacterVector labels(document_predictions.size());
+      for (size_t j = 0; j < document_predictions.size(); ++j) {
+        probabilities[j] = std::exp(document_predictions[j].first);
+        labels[j] = label_names[document_predictions[j].second];
       }
-      NumericVector probabilities(probabilitiesFasttext);
       probabilities.attr("names") = labels;
       list[i] = probabilities;
-      if (i % 5 == 0) Rcpp::checkUserInterrupt();
     }
     return list;
   }
 
+  NumericMatrix predict_probabilities(CharacterVector documents, int nthreads = 1) {
+    check_model_loaded();
+    if (nthreads < 1) {
+      stop("nthreads should be 1 or higher");
+    }
+    const int32_t n_documents = documents.size();
+    const int32_t n_labels = model->getDictionary()->nlabels();
+    std::vector<TextSpan> texts = as_spans(documents);
+    // row major, copied at the end into the column major R matrix
+    std::vector<real> probabilities(static_cast<size_t>(n_documents) * n_labels);
+
+    parallel_chunks(texts, nthreads, [&](int32_t begin, int32_t end, Model::BatchState& batch,
+                                               std::vector<std::vector<int32_t>>& inputs) {
+      model->predictProbabilities(inputs, batch);
+      std::copy(batch.output.data(), batch.output.data() + (end - begin) * n_labels,
+                probabilities.begin() + static_cast<size_t>(begin) * n_labels);
+    });
+
+    NumericMatrix result(n_documents, n_labels);
+    for (int32_t i = 0; i < n_documents; ++i) {
+      for (int32_t j = 0; j < n_labels; ++j) {
+        result(i, j) = probabilities[static_cast<size_t>(i) * n_labels + j];
+      }
+    }
+    colnames(result) = wrap(get_label_names());
+    return result;
+  }
+
+  // Predictions of each line of the input file, written to the output file block after block:
+  // memory does not depend on the size of the file. Returns the number of lines.
+  double predict_file(const std::string& input, const std::string& output, int k, real threshold,
+                      int nthreads, bool binary) {
+    check_model_loaded();
+    if (nthreads < 1) {
+      stop("nthreads should be 1 or higher");
+    }
+    std::ifstream in(input);
+    if (!in.is_open()) {
+      stop("Input file cannot be opened: " + input);
+    }
+    std::ofstream out(output, std::ofstream::binary);
+    if (!out.is_open()) {
+      stop("Output file cannot be opened: " + output);
+    }
+    const std::vector<std::string> label_names = get_label_names();
+    // binary records have room for k predictions
+    const int32_t slots = std::min<int32_t>(k, label_names.size());
+    if (binary) {
+      out.write(reinterpret_cast<const char*>(&slots), sizeof(int32_t));
+    }
+
+    std::string block, line;
+    std::vector<size_t> line_ends;
+    std::vector<TextSpan> texts;
+    std::vector<std::string> chunk_outputs;
+    double n_documents = 0;
+    while (true) {
+      block.clear();
+      line_ends.clear();
+      while (line_ends.size() < predict_file_block_size && std::getline(in, line)) {
+        block.append(line);
+        // like fasttext predict, the end of line is a token of the document
+        if (!in.eof()) {
+          block.push_back('\n');
+        }
+        line_ends.push_back(block.size());
+      }
+      if (line_ends.empty()) {
+        break;
+      }
+      texts.resize(line_ends.size());
+      for (size_t i = 0, start = 0; i < line_ends.size(); start = line_ends[i++]) {
+        texts[i] = TextSpan{block.data() + start, line_ends[i] - start};
+      }
+
+      // each chunk is formatted by the worker which scored it, then written in order
+      chunk_outputs.assign((texts.size() + predict_chunk_size - 1) / predict_chunk_size, std::string());
+      parallel_chunks(texts, nthreads, [&](int32_t begin, int32_t end, Model::BatchState& batch,
+                                           std::vector<std::vector<int32_t>>& inputs) {
+        std::vector<Predictions> chunk_predictions;
+        model->predict(k, inputs, chunk_predictions, batch, threshold);
+        std::string& text = chunk_outputs[begin / predict_chunk_size];
+        for (const Predictions& predictions : chunk_predictions) {
+          if (binary) {
+            append_binary(predictions, slots, text);
+          } else {
+            append_tsv(predictions, label_names, text);
+          }
+        }
+      });
+      for (const std::string& text : chunk_outputs) {
+        out.write(text.data(), text.size());
+      }
+      if (!out) {
+        stop("Error while writing to " + output);
+      }
+      n_documents += texts.size();
+    }
+    return n_documents;
+  }
+
   List get_parameters(){
     check_model_loaded();
     double learning_rate(model->getArgs().lr);
@@ -141,23 +322,32 @@ public:
     return wrap(std::vector<real>(vec.data(), vec.data() + vec.size()));
   }
 
-  NumericMatrix get_vectors(CharacterVector words){
+  NumericMatrix get_vectors(CharacterVector words, int nthreads = 1){
     check_model_loaded();
     int dim(model->getDimension());
-    NumericMatrix mat(words.size(), dim);
-    CharacterVector names(words.size());
-
-    for(int i = 0 ; i < words.size(); ++i) {
-      std::string word(words(i));
-      names[i] = word;
-      mat.row(i) = get_vector(word);
-      Rcpp::checkUserInterrupt();
+    std::vector<std::string> word_strings(words.size());
+    for (R_xlen_t i = 0; i < words.size(); ++i) {
+      word_strings[i] = as<std::string>(words[i]);
     }
+    fasttext::DenseMatrix vectors(words.size(), dim);
+    model->getWordVectors(word_strings, vectors, nthreads);
 
-    rownames(mat) = names;
+    NumericMatrix mat(words.size(), dim);
+    for (R_xlen_t i = 0; i < words.size(); ++i) {
+      for (int j = 0; j < dim; j++) {
+        mat(i, j) = vectors.at(i, j);
+      }
+    }
+    rownames(mat) = words;
     return mat;
   }
 
+  // Vectors of the words of the dictionary, in the binary format read by read_word_vectors (or as text)
+  void save_vectors(const std::string& path, bool binary, int nthreads) {
+    check_model_loaded();
+    model->saveVectors(path, binary, nthreads);
+  }
+
   NumericVector get_word_ids(CharacterVector words) {
     check_model_loaded();
     NumericVector ids(words.size());
@@ -180,12 +370,20 @@ public:
     return labels;
   }
 
-  void test(const std::string& filename, int32_t k) {
-    std::ifstream ifs(filename);
-    if(!ifs.is_open()) {
+  // evaluation on a labelled file, whose lines are split between nthreads workers
+  List test(const std::string& filename, int32_t k, real threshold, int nthreads) {
+    check_model_loaded();
+    if (nthreads < 1) {
+      stop("nthreads should be 1 or higher");
+    }
+    if(!std::ifstream(filename)) {
       stop("Test file cannot be opened!");
     }
-    model->test(ifs, k);
+    Meter meter;
+    model->test(filename, k, threshold, meter, nthreads);
+    return List::create(Named("n") = wrap(static_cast<double>(meter.nexamples())),
+                        Named("precision") = wrap(meter.precision()),
+                        Named("recall") = wrap(meter.recall()));
   }
 
   std::vector<std::pair<real,std::string> > predict_proba(const std::string& text, int32_t k, real threshold) {
@@ -195,22 +393,52 @@ public:
     return predictions;
   }
 
-  NumericVector get_nn_by_word(const std::string& queryWord, int32_t k) {
-    std::vector<std::pair<real, std::string>> results = model->getNN(queryWord, k);
+  NumericVector get_nn_by_word(const std::string& queryWord, int32_t k, int32_t ef) {
+    check_model_loaded();
+    return nn_to_vector(model->getNN(queryWord, k, ef));
+  }
 
-    NumericVector distances(k);
-    CharacterVector word_string(k);
-    int32_t i = 0;
+  NumericVector get_nn_by_vector(NumericVector query, int32_t k, int32_t ef) {
+    check_model_loaded();
+    if (query.size() != model->getDimension()) {
+      stop("Vector must have " + std::to_string(model->getDimension()) + " elements");
+    }
+    fasttext::Vector vec(query.size());
+    for (int i = 0; i < query.size(); ++i) {
+      vec[i] = query[i];
+    }
+    return nn_to_vector(model->getNN(vec, k, ef));
+  }
 
-    for (int i = 0; i < results.size(); ++i) {
-      distances[i] = results[i].first;
-      word_string[i] = results[i].second;
-      Rcpp::checkUserInterrupt();
+  void build_nn_index(int32_t M, int32_t ef_construction, int32_t nthreads) {
+    check_model_loaded();
+    model->buildNNIndex(M, ef_construction, nthreads);
+  }
+
+  void save_nn_index(const std::string& path) {
+    check_model_loaded();
+    model->saveNNIndex(path);
+  }
+
+  void load_nn_index(const std::string& path) {
+    check_model_loaded();
+    if(!std::ifstream(path)){
+      stop("Path doesn't point to a file: " + path);
     }
+    model->loadNNIndex(path);
+  }
 
-    distances.attr("names") = word_string;
+  void save_nn_vectors(const std::string& path, int nthreads) {
+    check_model_loaded();
+    model->saveNNVectors(path, nthreads);
+  }
 
-    return distances;
+  void load_nn_vectors(const std::string& path) {
+    check_model_loaded();
+    if(!std::ifstream(path)){
+      stop("Path doesn't point to a file: " + path);
+    }
+    model->loadNNVectors(path);
   }
 
   void print_help(){
@@ -220,15 +448,14 @@ public:
 
   CharacterVector tokenize(const std::string text){
     check_model_loaded();
-    std::vector<std::string> text_split;
     std::shared_ptr<const fasttext::Dictionary> d = model->getDictionary();
-    std::stringstream ioss;
-    copy(text.begin(), text.end(), std::ostream_iterator<char>(ioss));
-    std::string token;
-    while (!ioss.eof()) {
-      while (d->readWord(ioss, token)) {
-        text_split.push_back(token);
-      }
+    std::vector<std::string> text_split;
+    const char* begin = text.data();
+    const char* end = begin + text.size();
+    TextSpan token;
+    uint32_t h;
+    while (d->readWord(begin, end, token, h)) {
+      text_split.emplace_back(token.data, token.size);
     }
     return wrap(text_split);
   }
@@ -236,18 +463,24 @@ public:
   NumericVector get_sentence_embeddings(const CharacterVector& sentences) {
     check_model_loaded();
     int dimensions = model->getDimension();
-    NumericMatrix sentence_embeddings(sentences.size(), dimensions);
-
-    fasttext::Vector v(dimensions);
-    NumericVector vector_r;
-    std::string sentence;
-    for (int i = 0; i < sentences.size(); i++) {
-      std::stringstream ioss;
-      sentence = as<std::string>(sentences[i]);
-      copy(sentence.begin(), sentence.end(), std::ostream_iterator<char>(ioss));
-      model->getSentenceVector(ioss, v);
-      vector_r = wrap(std::vector<real>(v.data(), v.data() + v.size()));
-      sentence_embeddings(i, _) = vector_r;
+    const int32_t n_sentences = sentences.size();
+    NumericMatrix sentence_embeddings(n_sentences, dimensions);
+
+    std::vector<TextSpan> texts;
+    fasttext::DenseMatrix vectors(sentence_chunk_size, dimensions);
+    for (int32_t begin = 0; begin < n_sentences; begin += sentence_chunk_size) {
+      const int32_t end = std::min(begin + sentence_chunk_size, n_sentences);
+      texts.clear();
+      for (int32_t i = begin; i < end; i++) {
+        texts.push_back(text_span(sentences, i));
+      }
+      model->getSentenceVectors(texts, vectors);
+      for (int32_t i = begin; i < end; i++) {
+        for (int j = 0; j < dimensions; j++) {
+          sentence_embeddings(i, j) = vectors.at(i - begin, j);
+        }
+      }
+      Rcpp::checkUserInterrupt();
     }
 
     return sentence_embeddings;
@@ -256,6 +489,138 @@ public:
 private:
   std::unique_ptr<FastText> model;
   bool model_loaded;
+  // documents scored together by one product with the output matrix
+  static const int32_t predict_chunk_size = 64;
+  static const int32_t sentence_chunk_size = 256;
+  // lines of a file read (and written) at once by predict_file
+  static const size_t predict_file_block_size = 65536;
+
+  // R objects are only accessed from the main thread, workers read the characters of the documents
+  // in place (the R vector is alive and not modified during the call)
+  static std::vector<TextSpan> as_spans(const CharacterVector& documents) {
+    std::vector<TextSpan> texts(documents.size());
+    for (R_xlen_t i = 0; i < documents.size(); ++i) {
+      texts[i] = text_span(documents, i);
+    }
+    return texts;
+  }
+
+  // label names without their prefix
+  std::vector<std::string> get_label_names() {
+    int label_prefix_size = model->getArgs().label.size();
+    std::vector<std::string> label_names(model->getDictionary()->nlabels());
+    for (size_t i = 0; i < label_names.size(); ++i) {
+      label_names[i] = getLabel(i).erase(0, label_prefix_size);
+    }
+    return label_names;
+  }
+
+  // Calls process(begin, end, batch, inputs) on each chunk of the documents, inputs being the
+  // parsed documents begin to end - 1. Each of the nthreads workers owns its buffers and pulls
+  // chunks until none is left. The first error of a worker is rethrown in the main thread.
+  template <typename Process>
+  void parallel_chunks(const std::vector<TextSpan>& texts, int nthreads, Process process) {
+    const int32_t n_documents = texts.size();
+    std::atomic<int32_t> next_document(0);
+    std::atomic<bool> interrupted(false);
+    std::exception_ptr worker_error = nullptr;
+    std::mutex worker_error_mutex;
+    std::shared_ptr<const fasttext::Dictionary> dictionary = model->getDictionary();
+
+    auto worker = [&](bool main_thread) {
+      Model::BatchState batch(predict_chunk_size, model->getDimension(), dictionary->nlabels());
+      std::vector<std::vector<int32_t>> inputs;
+      std::vector<int32_t> labels, hashes;
+      while (!interrupted) {
+        const int32_t begin = next_document.fetch_add(predict_chunk_size);
+        if (begin >= n_documents) {
+          break;
+        }
+        const int32_t end = std::min(begin + predict_chunk_size, n_documents);
+        try {
+          inputs.resize(end - begin);
+          for (int32_t i = begin; i < end; ++i) {
+            const char* text = texts[i].data;
+            dictionary->getLine(text, text + texts[i].size, inputs[i - begin], labels, hashes);
+          }
+          process(begin, end, batch, inputs);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(worker_error_mutex);
+          if (!worker_error) {
+            worker_error = std::current_exception();
+          }
+          interrupted = true;
+        }
+        // only the main thread is allowed to talk with R
+        if (main_thread) {
+          Rcpp::checkUserInterrupt();
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (int32_t t = 1; t < nthreads; ++t) {
+      threads.push_back(std::thread([&]() { worker(false); }));
+    }
+    try {
+      worker(true);
+    } catch (...) {
+      interrupted = true;
+      for (auto& thread : threads) {
+        thread.join();
+      }
+      throw;
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    if (worker_error) {
+      std::rethrow_exception(worker_error);
+    }
+  }
+
+  // label<TAB>probability for each prediction, TAB separated, and a new line
+  static void append_tsv(const Predictions& predictions, const std::vector<std::string>& label_names,
+                         std::string& text) {
+    char probability[32];
+    for (size_t j = 0; j < predictions.size(); ++j) {
+      if (j > 0) {
+        text.push_back('\t');
+      }
+      text.append(label_names[predictions[j].second]);
+      std::snprintf(probability, sizeof(probability), "\t%g", std::exp(predictions[j].first));
+      text.append(probability);
+    }
+    text.push_back('\n');
+  }
+
+  // slots label indices (int32, from 1, NA when there are less predictions) followed by slots
+  // probabilities (float32, NaN when there are less predictions)
+  static void append_binary(const Predictions& predictions, int32_t slots, std::string& text) {
+    const int32_t n = predictions.size();
+    for (int32_t j = 0; j < slots; ++j) {
+      int32_t label = j < n ? predictions[j].second + 1 : NA_INTEGER;
+      text.append(reinterpret_cast<const char*>(&label), sizeof(int32_t));
+    }
+    for (int32_t j = 0; j < slots; ++j) {
+      float probability = j < n ? std::exp(predictions[j].first) : std::numeric_limits<float>::quiet_NaN();
+      text.append(reinterpret_cast<const char*>(&probability), sizeof(float));
+    }
+  }
+
+  static NumericVector nn_to_vector(const std::vector<std::pair<real, std::string>>& results) {
+    NumericVector distances(results.size());
+    CharacterVector word_string(results.size());
+
+    for (int i = 0; i < results.size(); ++i) {
+      distances[i] = results[i].first;
+      word_string[i] = results[i].second;
+    }
+
+    distances.attr("names") = word_string;
+
+    return distances;
+  }
 
   void check_model_loaded(){
     if(!model_loaded){
@@ -308,14 +673,25 @@ RCPP_MODULE(FASTRTEXT_MODULE) {
   .constructor("Managed fasttext model")
   .method("load", &fastrtext::load, "Load a model")
   .method("predict", &fastrtext::predict, "Make a prediction")
+  .method("predict_probabilities", &fastrtext::predict_probabilities, "Get the probabilities of all labels")
+  .method("predict_file", &fastrtext::predict_file, "Write the predictions of the lines of a file to another file")
   .method("execute", &fastrtext::execute, "Execute commands")
+  .method("train", &fastrtext::train, "Train a model from documents in memory")
   .method("get_word_ids", &fastrtext::get_word_ids, "Get ID of of provided words")
   .method("get_vector", &fastrtext::get_vector, "Get vector related to the provided word")
   .method("get_vectors", &fastrtext::get_vectors, "Get vectors related to provided words")
+  .method("save_vectors", &fastrtext::save_vectors, "Save the vectors of the words of the dictionary")
   .method("get_parameters", &fastrtext::get_parameters, "Get parameters used to train the model")
   .method("get_dictionary", &fastrtext::get_dictionary, "List all words learned")
   .method("get_labels", &fastrtext::get_labels, "List all labels")
   .method("get_nn_by_word", &fastrtext::get_nn_by_word, "Get nearest neighbour words, providing a word")
+  .method("get_nn_by_vector", &fastrtext::get_nn_by_vector, "Get nearest neighbour words, providing a vector")
+  .method("build_nn_index", &fastrtext::build_nn_index, "Build an approximate nearest neighbour index")
+  .method("save_nn_index", &fastrtext::save_nn_index, "Save the nearest neighbour index")
+  .method("load_nn_index", &fastrtext::load_nn_index, "Load a nearest neighbour index")
+  .method("save_nn_vectors", &fastrtext::save_nn_vectors, "Save the word vectors of nearest neighbour searches")
+  .method("load_nn_vectors", &fastrtext::load_nn_vectors, "Load the word vectors of nearest neighbour searches")
+  .method("test", &fastrtext::test, "Precision and recall on a labelled file")
   .method("tokenize", &fastrtext::tokenize, "Tokenize a text in words")
   .method("get_sentence_embeddings", &fastrtext::get_sentence_embeddings, "Get the dense representation of sentences")
   .method("print_help", &fastrtext::print_help, "Print command helps");
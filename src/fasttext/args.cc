@@ -31,12 +31,16 @@ Args::Args() {
   minn = 3;
   maxn = 6;
   thread = 12;
+  outputSync = 0;
+  batchContexts = 0;
+  slidingWindow = 0;
   lrUpdateRate = 100;
   t = 1e-4;
   label = "__label__";
   verbose = 2;
   pretrainedVectors = "";
   saveOutput = false;
+  binaryVectors = false;
   seed = 0;
 
   qout = false;
@@ -50,6 +54,8 @@ Args::Args() {
   autotunePredictions = 1;
   autotuneDuration = 60 * 5; // 5 minutes
   autotuneModelSize = "";
+  autotuneParallel = 1;
+  autotuneHalving = 0;
 }
 
 std::string Args::lossToString(loss_name ln) const {
@@ -166,6 +172,12 @@ void Args::parseArgs(const std::vector<std::string>& args) {
         maxn = std::stoi(args.at(ai + 1));
       } else if (args[ai] == "-thread") {
         thread = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-outputSync") {
+        outputSync = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-batchContexts") {
+        batchContexts = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-slidingWindow") {
+        slidingWindow = std::stoi(args.at(ai + 1));
       } else if (args[ai] == "-t") {
         t = std::stof(args.at(ai + 1));
       } else if (args[ai] == "-label") {
@@ -177,6 +189,9 @@ void Args::parseArgs(const std::vector<std::string>& args) {
       } else if (args[ai] == "-saveOutput") {
         saveOutput = true;
         ai--;
+      } else if (args[ai] == "-binaryVectors") {
+        binaryVectors = true;
+        ai--;
       } else if (args[ai] == "-seed") {
         seed = std::stoi(args.at(ai + 1));
       } else if (args[ai] == "-qnorm") {
@@ -204,6 +219,10 @@ void Args::parseArgs(const std::vector<std::string>& args) {
         autotuneDuration = std::stoi(args.at(ai + 1));
       } else if (args[ai] == "-autotune-modelsize") {
         autotuneModelSize = std::string(args.at(ai + 1));
+      } else if (args[ai] == "-autotune-parallel") {
+        autotuneParallel = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-autotune-halving") {
+        autotuneHalving = std::stoi(args.at(ai + 1));
       } else {
         std::cerr << "Unknown argument: " << args[ai] << std::endl;
         printHelp();
@@ -272,10 +291,18 @@ void Args::printTrainingHelp() {
       << lossToString(loss) << "]\n"
       << "  -thread             number of threads (set to 1 to ensure reproducible results) ["
       << thread << "]\n"
+      << "  -outputSync         lines between the syncs of the copies of the output matrix of each thread (two copies per thread, supervised only), 0 for a shared matrix ["
+      << outputSync << "]\n"
+      << "  -batchContexts      1 to compute and update the vector of a word once for its whole context window (skipgram) ["
+      << batchContexts << "]\n"
+      << "  -slidingWindow      1 to keep the sum of the context window as it slides, each word being updated when it leaves it (cbow) ["
+      << slidingWindow << "]\n"
       << "  -pretrainedVectors  pretrained word vectors for supervised learning ["
       << pretrainedVectors << "]\n"
       << "  -saveOutput         whether output params should be saved ["
       << boolToString(saveOutput) << "]\n"
+      << "  -binaryVectors      whether word vectors should be saved in binary (.vecb) instead of text (.vec) ["
+      << boolToString(binaryVectors) << "]\n"
       << "  -seed               random generator seed  [" << seed << "]\n";
 }
 
@@ -290,7 +317,11 @@ void Args::printAutotuneHelp() {
       << "  -autotune-duration              maximum duration in seconds ["
       << autotuneDuration << "]\n"
       << "  -autotune-modelsize             constraint model file size ["
-      << autotuneModelSize << "] (empty = do not quantize)\n";
+      << autotuneModelSize << "] (empty = do not quantize)\n"
+      << "  -autotune-parallel              number of trials run at the same time, sharing the threads ["
+      << autotuneParallel << "]\n"
+      << "  -autotune-halving               stop the trials not among the best 1/N at 1/N^2 and 1/N of their training ["
+      << autotuneHalving << "] (0 = train all trials fully)\n";
 }
 
 void Args::printQuantizationHelp() {
@@ -46,11 +46,15 @@ class Args {
   int minn;
   int maxn;
   int thread;
+  int outputSync;
+  int batchContexts;
+  int slidingWindow;
   double t;
   std::string label;
   int verbose;
   std::string pretrainedVectors;
   bool saveOutput;
+  bool binaryVectors;
   int seed;
 
   bool qout;
@@ -64,6 +68,8 @@ class Args {
   int autotunePredictions;
   int autotuneDuration;
   std::string autotuneModelSize;
+  int autotuneParallel;
+  int autotuneHalving;
 
   void parseArgs(const std::vector<std::string>& args);
   void printHelp();
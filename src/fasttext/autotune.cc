@@ -9,6 +9,7 @@
 #include "autotune.h"
 
 #include <algorithm>
+#include <cmath>
 #include <csignal>
 #include <functional>
 #include <iomanip>
@@ -200,14 +201,42 @@ void AutotuneStrategy::updateBest(const Args& args) {
   }
 }
 
+AutotuneScheduler::AutotuneScheduler(int eta) : eta_(eta) {
+  rungs_ = {1.0 / (eta * eta), 1.0 / eta};
+  scores_.resize(rungs_.size());
+}
+
+int32_t AutotuneScheduler::nrungs() const {
+  return rungs_.size();
+}
+
+double AutotuneScheduler::rung(int32_t rung) const {
+  return rungs_[rung];
+}
+
+bool AutotuneScheduler::promote(int32_t rung, double score) {
+  if (std::isnan(score)) {
+    score = -std::numeric_limits<double>::infinity();
+  }
+  std::vector<double>& scores = scores_[rung];
+  scores.push_back(score);
+  const int64_t better = std::count_if(
+      scores.begin(), scores.end(), [score](double s) { return s > score; });
+  return better < std::max<int64_t>(1, scores.size() / eta_);
+}
+
 Autotune::Autotune(const std::shared_ptr<FastText>& fastText)
     : fastText_(fastText),
+      trialFastTexts_(),
       elapsed_(0.),
       bestScore_(0.),
+      bestTrainArgs_(),
       trials_(0),
       sizeConstraintFailed_(0),
+      sizeConstraintWarning_(false),
       continueTraining_(false),
       strategy_(),
+      scheduler_(),
       timer_() {}
 
 void Autotune::printInfo(double maxDuration) {
@@ -249,7 +278,9 @@ bool Autotune::keepTraining(double maxDuration) const {
 void Autotune::abort() {
   if (continueTraining_) {
     continueTraining_ = false;
-    fastText_->abort();
+    for (const auto& fastText : trialFastTexts_) {
+      fastText->abort();
+    }
   }
 }
 
@@ -270,6 +301,7 @@ void Autotune::startTimer(const Args& args) {
 }
 
 double Autotune::getMetricScore(
+    const FastText& fastText,
     Meter& meter,
     const metric_name& metricName,
     const std::string& metricLabel) const {
@@ -277,11 +309,11 @@ double Autotune::getMetricScore(
   if (metricName == metric_name::f1score) {
     score = meter.f1Score();
   } else if (metricName == metric_name::labelf1score) {
-    int32_t labelId = fastText_->getDictionary()->getId(metricLabel);
+    int32_t labelId = fastText.getDictionary()->getId(metricLabel);
     if (labelId == -1) {
       throw std::runtime_error("Unknown autotune metric label");
     }
-    labelId = labelId - fastText_->getDictionary()->nwords();
+    labelId = labelId - fastText.getDictionary()->nwords();
     score = meter.f1Score(labelId);
   } else {
     throw std::runtime_error("Unknown metric");
@@ -303,13 +335,14 @@ void Autotune::printArgs(const Args& args, const Args& autotuneArgs) {
 }
 
 int Autotune::getCutoffForFileSize(
+    const FastText& fastText,
     bool qout,
     bool qnorm,
     int dsub,
     int64_t fileSize) const {
   int64_t outModelSize = 0;
-  const int64_t outM = fastText_->getOutputMatrix()->size(0);
-  const int64_t outN = fastText_->getOutputMatrix()->size(1);
+  const int64_t outM = fastText.getOutputMatrix()->size(0);
+  const int64_t outN = fastText.getOutputMatrix()->size(1);
   if (qout) {
     const int64_t outputPqSize = 16 + 4 * (outN * (1 << 8));
     outModelSize =
@@ -317,7 +350,7 @@ int Autotune::getCutoffForFileSize(
   } else {
     outModelSize = 16 + 4 * (outM * outN);
   }
-  const int64_t dim = fastText_->getInputMatrix()->size(1);
+  const int64_t dim = fastText.getInputMatrix()->size(1);
 
   int target = (fileSize - (107) - 4 * (1 << 8) * dim - outModelSize);
   int cutoff = target / ((dim + dsub - 1) / dsub + (qnorm ? 1 : 0) + 10);
@@ -325,22 +358,29 @@ int Autotune::getCutoffForFileSize(
   return std::max(cutoff, kCutoffLimit);
 }
 
-bool Autotune::quantize(Args& args, const Args& autotuneArgs) {
+bool Autotune::quantize(
+    FastText& fastText,
+    Args& args,
+    const Args& autotuneArgs) {
   if (autotuneArgs.getAutotuneModelSize() == Args::kUnlimitedModelSize) {
     return true;
   }
-  auto outputSize = fastText_->getOutputMatrix()->size(0);
+  auto outputSize = fastText.getOutputMatrix()->size(0);
 
   args.qnorm = true;
   args.qout = (outputSize >= kCutoffLimit);
   args.retrain = true;
   args.cutoff = getCutoffForFileSize(
-      args.qout, args.qnorm, args.dsub, autotuneArgs.getAutotuneModelSize());
+      fastText,
+      args.qout,
+      args.qnorm,
+      args.dsub,
+      autotuneArgs.getAutotuneModelSize());
   LOG_VAL(cutoff, args.cutoff);
   if (args.cutoff == kCutoffLimit) {
     return false;
   }
-  fastText_->quantize(args);
+  fastText.quantize(args);
 
   return true;
 }
@@ -364,54 +404,84 @@ void Autotune::printSkippedArgs(const Args& autotuneArgs) {
   }
 }
 
-void Autotune::train(const Args& autotuneArgs) {
-  std::ifstream validationFileStream(autotuneArgs.autotuneValidationFile);
-  if (!validationFileStream.is_open()) {
-    throw std::invalid_argument("Validation file cannot be opened!");
-  }
-  printSkippedArgs(autotuneArgs);
-
-  bool sizeConstraintWarning = false;
-  int verbose = autotuneArgs.verbose;
-  Args bestTrainArgs(autotuneArgs);
-  Args trainArgs(autotuneArgs);
-  trainArgs.verbose = 0;
-  strategy_ = std::unique_ptr<AutotuneStrategy>(
-      new AutotuneStrategy(trainArgs, autotuneArgs.seed));
-  startTimer(autotuneArgs);
-
-  while (keepTraining(autotuneArgs.autotuneDuration)) {
-    trials_++;
-
-    trainArgs = strategy_->ask(elapsed_);
-    LOG_VAL(Trial, trials_)
-    printArgs(trainArgs, autotuneArgs);
+void Autotune::runTrials(
+    const Args& autotuneArgs,
+    FastText& fastText,
+    int nthreads) {
+  while (true) {
+    Args trainArgs;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!keepTraining(autotuneArgs.autotuneDuration)) {
+        return;
+      }
+      trials_++;
+      trainArgs = strategy_->ask(elapsed_);
+      trainArgs.thread = nthreads;
+      LOG_VAL(Trial, trials_)
+      printArgs(trainArgs, autotuneArgs);
+    }
     ElapsedTimeMarker elapsedTimeMarker;
     double currentScore = std::numeric_limits<double>::quiet_NaN();
+    // the scheduler evaluates the trial while it trains and stops it through
+    // FastText::abort if it is not promoted
+    int32_t rung = 0;
+    bool stopped = false;
+    auto evaluate = [&](real progress) {
+      if (!scheduler_ || rung >= scheduler_->nrungs() ||
+          progress < scheduler_->rung(rung)) {
+        return;
+      }
+      Meter meter;
+      fastText.test(
+          autotuneArgs.autotuneValidationFile,
+          autotuneArgs.autotunePredictions,
+          0.0,
+          meter,
+          nthreads);
+      double score = getMetricScore(
+          fastText,
+          meter,
+          autotuneArgs.getAutotuneMetric(),
+          autotuneArgs.getAutotuneMetricLabel());
+      std::lock_guard<std::mutex> lock(mutex_);
+      LOG_VAL_NAN(rungScore, score)
+      if (!scheduler_->promote(rung++, score)) {
+        stopped = true;
+        fastText.abort();
+      }
+    };
     try {
-      fastText_->train(trainArgs);
-      bool sizeConstraintOK = quantize(trainArgs, autotuneArgs);
+      fastText.train(trainArgs, evaluate);
+      bool sizeConstraintOK = quantize(fastText, trainArgs, autotuneArgs);
       if (sizeConstraintOK) {
         Meter meter;
-        fastText_->test(
-            validationFileStream, autotuneArgs.autotunePredictions, 0.0, meter);
-
+        fastText.test(
+            autotuneArgs.autotuneValidationFile,
+            autotuneArgs.autotunePredictions,
+            0.0,
+            meter,
+            nthreads);
         currentScore = getMetricScore(
+            fastText,
             meter,
             autotuneArgs.getAutotuneMetric(),
             autotuneArgs.getAutotuneMetricLabel());
+      }
 
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (sizeConstraintOK) {
         if (bestScore_ == Autotune::kUnknownBestScore ||
             (currentScore > bestScore_)) {
-          bestTrainArgs = trainArgs;
+          bestTrainArgs_ = trainArgs;
           bestScore_ = currentScore;
-          strategy_->updateBest(bestTrainArgs);
+          strategy_->updateBest(bestTrainArgs_);
         }
       } else {
         sizeConstraintFailed_++;
-        if (!sizeConstraintWarning && trials_ > 10 &&
+        if (!sizeConstraintWarning_ && trials_ > 10 &&
             sizeConstraintFailed_ > (trials_ / 2)) {
-          sizeConstraintWarning = true;
+          sizeConstraintWarning_ = true;
           std::cerr
               << std::endl
               << "Warning : requested model size is probably too small. You may want to increase `autotune-modelsize`."
@@ -423,20 +493,78 @@ void Autotune::train(const Args& autotuneArgs) {
     } catch (std::bad_alloc&) {
       // ignore parameter samples asking too much memory
     } catch (TimeoutError&) {
-      break;
+      return;
     } catch (FastText::AbortError&) {
-      break;
+      if (!stopped) {
+        return;
+      }
+      // stopped by the scheduler, go on with the next trial
+    } catch (...) {
+      // stop the other trials
+      abort();
+      throw;
     }
+    std::lock_guard<std::mutex> lock(mutex_);
     LOG_VAL_NAN(currentScore, currentScore)
     LOG_VAL(train took, elapsedTimeMarker.getElapsed())
   }
+}
+
+void Autotune::train(const Args& autotuneArgs) {
+  std::ifstream validationFileStream(autotuneArgs.autotuneValidationFile);
+  if (!validationFileStream.is_open()) {
+    throw std::invalid_argument("Validation file cannot be opened!");
+  }
+  validationFileStream.close();
+  printSkippedArgs(autotuneArgs);
+
+  int verbose = autotuneArgs.verbose;
+  bestTrainArgs_ = autotuneArgs;
+  sizeConstraintFailed_ = 0;
+  sizeConstraintWarning_ = false;
+  Args trainArgs(autotuneArgs);
+  trainArgs.verbose = 0;
+  strategy_ = std::unique_ptr<AutotuneStrategy>(
+      new AutotuneStrategy(trainArgs, autotuneArgs.seed));
+  scheduler_.reset();
+  if (autotuneArgs.autotuneHalving > 1) {
+    scheduler_ = std::unique_ptr<AutotuneScheduler>(
+        new AutotuneScheduler(autotuneArgs.autotuneHalving));
+  }
+
+  // the threads are split between the concurrent trials
+  const int nthreads = std::max(1, autotuneArgs.thread);
+  const int ntrials =
+      std::max(1, std::min(autotuneArgs.autotuneParallel, nthreads));
+  trialFastTexts_.clear();
+  for (int i = 0; i < ntrials; i++) {
+    trialFastTexts_.push_back(std::make_shared<FastText>());
+  }
+  startTimer(autotuneArgs);
+
+  try {
+    utils::parallelFor(ntrials, ntrials, [&](int64_t begin, int64_t end) {
+      for (auto i = begin; i < end; i++) {
+        runTrials(
+            autotuneArgs,
+            *trialFastTexts_[i],
+            nthreads / ntrials + (i < nthreads % ntrials ? 1 : 0));
+      }
+    });
+  } catch (...) {
+    abort();
+    timer_.join();
+    trialFastTexts_.clear();
+    throw;
+  }
   if (timer_.joinable()) {
     timer_.join();
   }
+  trialFastTexts_.clear();
 
   if (bestScore_ == Autotune::kUnknownBestScore) {
     std::string errorMessage;
-    if (sizeConstraintWarning) {
+    if (sizeConstraintWarning_) {
       errorMessage =
           "Couldn't fulfil model size constraint: please increase `autotune-modelsize`.";
     } else {
@@ -447,11 +575,13 @@ void Autotune::train(const Args& autotuneArgs) {
   } else {
     std::cerr << std::endl;
     std::cerr << "Training again with best arguments" << std::endl;
+    Args bestTrainArgs(bestTrainArgs_);
     bestTrainArgs.verbose = verbose;
+    bestTrainArgs.thread = autotuneArgs.thread;
     LOG_VAL(Best selected args, 0)
     printArgs(bestTrainArgs, autotuneArgs);
     fastText_->train(bestTrainArgs);
-    quantize(bestTrainArgs, autotuneArgs);
+    quantize(*fastText_, bestTrainArgs, autotuneArgs);
   }
 }
 
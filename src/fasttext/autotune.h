@@ -10,6 +10,7 @@
 
 #include <istream>
 #include <memory>
+#include <mutex>
 #include <random>
 #include <thread>
 #include <vector>
@@ -39,16 +40,41 @@ class AutotuneStrategy {
   void updateBest(const Args& args);
 };
 
+// Successive halving of the trials: at 1/eta^2, then at 1/eta of its
+// training, a trial only goes on if its validation score is among the best
+// 1/eta of the scores of all the trials evaluated at the same point.
+class AutotuneScheduler {
+ private:
+  int eta_;
+  std::vector<double> rungs_;
+  std::vector<std::vector<double>> scores_;
+
+ public:
+  explicit AutotuneScheduler(int eta);
+  int32_t nrungs() const;
+  // progress of the training at which a trial is evaluated for the rung
+  double rung(int32_t rung) const;
+  // records the score of a trial at the rung, returns whether it goes on
+  bool promote(int32_t rung, double score);
+};
+
 class Autotune {
  protected:
   std::shared_ptr<FastText> fastText_;
+  // one model per concurrent trial (-autotune-parallel)
+  std::vector<std::shared_ptr<FastText>> trialFastTexts_;
   double elapsed_;
   double bestScore_;
+  Args bestTrainArgs_;
   int32_t trials_;
   int32_t sizeConstraintFailed_;
+  bool sizeConstraintWarning_;
   std::atomic<bool> continueTraining_;
   std::unique_ptr<AutotuneStrategy> strategy_;
+  std::unique_ptr<AutotuneScheduler> scheduler_;
   std::thread timer_;
+  // guards the strategy and the results shared by concurrent trials
+  std::mutex mutex_;
 
   bool keepTraining(double maxDuration) const;
   void printInfo(double maxDuration);
@@ -58,14 +84,22 @@ class Autotune {
   void abort();
   void startTimer(const Args& args);
   double getMetricScore(
+      const FastText& fastText,
       Meter& meter,
       const metric_name& metricName,
       const std::string& metricLabel) const;
   void printArgs(const Args& args, const Args& autotuneArgs);
   void printSkippedArgs(const Args& autotuneArgs);
-  bool quantize(Args& args, const Args& autotuneArgs);
-  int getCutoffForFileSize(bool qout, bool qnorm, int dsub, int64_t fileSize)
-      const;
+  bool quantize(FastText& fastText, Args& args, const Args& autotuneArgs);
+  int getCutoffForFileSize(
+      const FastText& fastText,
+      bool qout,
+      bool qnorm,
+      int dsub,
+      int64_t fileSize) const;
+  // trains and evaluates the candidates of the strategy one after the other
+  // with nthreads threads, until the time is up
+  void runTrials(const Args& autotuneArgs, FastText& fastText, int nthreads);
 
   class TimeoutError : public std::runtime_error {
    public:
@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "corpus.h"
+
+#include <string>
+#include <unordered_map>
+
+#include "dictionary.h"
+
+namespace fasttext {
+
+Corpus::Corpus(
+    const DocumentSource& source,
+    const Dictionary& dict,
+    const Args& args)
+    : eos_(kUnknownLabel) {
+  const bool keepUnknown = (args.model == model_name::sup);
+  std::unordered_map<std::string, int32_t> unknown;
+  oovOffsets_.push_back(0);
+
+  // returns false if the token is dropped
+  auto encode = [&](const std::string& token, int32_t& id) {
+    uint32_t h = dict.hash(token);
+    id = dict.getId(token, h);
+    if (id >= 0 || !keepUnknown) {
+      return id >= 0;
+    }
+    if (dict.getType(token) == entry_type::label) {
+      id = kUnknownLabel;
+      return true;
+    }
+    auto it = unknown.find(token);
+    if (it == unknown.end()) {
+      it = unknown.emplace(token, -int32_t(oovHashes_.size()) - 2).first;
+      oovHashes_.push_back(h);
+      if (token != Dictionary::EOS) {
+        dict.computeSubwords(
+            Dictionary::BOW + token + Dictionary::EOW, oovSubwords_);
+      }
+      oovOffsets_.push_back(oovSubwords_.size());
+    }
+    id = it->second;
+    return true;
+  };
+
+  int32_t id;
+  if (encode(Dictionary::EOS, id)) {
+    eos_ = id;
+  }
+  if (keepUnknown) {
+    hashes_.resize(dict.nwords());
+    for (int32_t i = 0; i < dict.nwords(); i++) {
+      hashes_[i] = dict.hash(dict.getWord(i));
+    }
+  }
+  tokens_.reserve(dict.ntokens());
+  std::vector<std::string> tokens;
+  for (int64_t i = 0; i < source.size(); i++) {
+    int32_t ntokens = dict.readDocument(source, i, tokens);
+    for (int32_t j = 0; j < ntokens; j++) {
+      if (encode(tokens[j], id)) {
+        tokens_.push_back(id);
+      }
+    }
+  }
+  tokens_.shrink_to_fit();
+}
+
+void Corpus::addUnknownSubwords(std::vector<int32_t>& line, int32_t id)
+    const {
+  const int32_t i = -id - 2;
+  line.insert(
+      line.end(),
+      oovSubwords_.begin() + oovOffsets_[i],
+      oovSubwords_.begin() + oovOffsets_[i + 1]);
+}
+
+int64_t Corpus::lineStart(int64_t pos) const {
+  while (pos > 0 && tokens_[pos - 1] != eos_) {
+    pos--;
+  }
+  return pos;
+}
+
+} // namespace fasttext
@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "args.h"
+#include "dictionary.h"
+
+namespace fasttext {
+
+class Dictionary;
+
+// Documents owned by the caller (e.g. an R character vector). Document i is
+// read as if it was the line "<labels(i)> <text(i)>\n" of a training file.
+class DocumentSource {
+ public:
+  virtual ~DocumentSource() = default;
+  virtual int64_t size() const = 0;
+  virtual TextSpan text(int64_t i) const = 0;
+  virtual TextSpan labels(int64_t) const {
+    return TextSpan{nullptr, 0};
+  }
+};
+
+// Training documents tokenized once and encoded against the dictionary, so
+// that the training threads share a read-only array of ids instead of
+// reading and hashing the input file again at each epoch.
+//
+// Lines are stored one after the other and end with the end of sentence
+// token. For supervised models, tokens missing from the dictionary are kept
+// because they still produce subwords and word n-grams:
+//   id >= 0   dictionary entry
+//   id == -1  unknown label, counted but ignored
+//   id <= -2  unknown word, entry -id - 2 of the out of vocabulary table
+// Otherwise unknown tokens are dropped, as Dictionary::getLine does.
+class Corpus {
+ protected:
+  std::vector<int32_t> tokens_;
+  std::vector<uint32_t> hashes_;
+  std::vector<uint32_t> oovHashes_;
+  std::vector<int64_t> oovOffsets_;
+  std::vector<int32_t> oovSubwords_;
+  int32_t eos_;
+
+ public:
+  static const int32_t kUnknownLabel = -1;
+
+  Corpus(const DocumentSource&, const Dictionary&, const Args&);
+
+  inline int64_t size() const {
+    return tokens_.size();
+  }
+  inline int32_t operator[](int64_t i) const {
+    return tokens_[i];
+  }
+  inline int32_t eos() const {
+    return eos_;
+  }
+  inline bool isWord(int32_t id, int32_t nwords) const {
+    return id < kUnknownLabel || (id >= 0 && id < nwords);
+  }
+  inline uint32_t hash(int32_t id) const {
+    return id >= 0 ? hashes_[id] : oovHashes_[-id - 2];
+  }
+  void addUnknownSubwords(std::vector<int32_t>& line, int32_t id) const;
+  int64_t lineStart(int64_t pos) const;
+};
+
+} // namespace fasttext
@@ -12,6 +12,7 @@
 #include <stdexcept>
 #include <thread>
 #include <utility>
+#include "kernels.h"
 #include "utils.h"
 #include "vector.h"
 
@@ -101,41 +102,64 @@ real DenseMatrix::dotRow(const Vector& vec, int64_t i) const {
   assert(i >= 0);
   assert(i < m_);
   assert(vec.size() == n_);
-  real d = 0.0;
-  for (int64_t j = 0; j < n_; j++) {
-    d += at(i, j) * vec[j];
-  }
+  real d = kernels::dot(&data_[i * n_], vec.data(), n_);
   if (std::isnan(d)) {
     throw EncounteredNaNError();
   }
   return d;
 }
 
+void DenseMatrix::dotRows(const Vector& vec, Vector& out) const {
+  assert(vec.size() == n_);
+  assert(out.size() == m_);
+  for (int64_t i = 0; i < m_; i++) {
+    out[i] = kernels::dot(&data_[i * n_], vec.data(), n_);
+  }
+  if (kernels::hasNaN(out.data(), m_)) {
+    throw EncounteredNaNError();
+  }
+}
+
+void DenseMatrix::dotRows(const real* x, int64_t m, real* out) const {
+  kernels::gemm(x, data_.data(), out, m, m_, n_, m_);
+  if (kernels::hasNaN(out, m * m_)) {
+    throw EncounteredNaNError();
+  }
+}
+
+void DenseMatrix::dotRowPairs(
+    const real* const* x,
+    const int64_t* rows,
+    int64_t n,
+    real* out) const {
+  for (int64_t i = 0; i < n; i++) {
+    assert(rows[i] >= 0 && rows[i] < m_);
+    out[i] = kernels::dot(&data_[rows[i] * n_], x[i], n_);
+  }
+  if (kernels::hasNaN(out, n)) {
+    throw EncounteredNaNError();
+  }
+}
+
 void DenseMatrix::addVectorToRow(const Vector& vec, int64_t i, real a) {
   assert(i >= 0);
   assert(i < m_);
   assert(vec.size() == n_);
-  for (int64_t j = 0; j < n_; j++) {
-    data_[i * n_ + j] += a * vec[j];
-  }
+  kernels::addScaled(&data_[i * n_], vec.data(), a, n_);
 }
 
 void DenseMatrix::addRowToVector(Vector& x, int32_t i) const {
   assert(i >= 0);
   assert(i < this->size(0));
   assert(x.size() == this->size(1));
-  for (int64_t j = 0; j < n_; j++) {
-    x[j] += at(i, j);
-  }
+  kernels::add(x.data(), &data_[i * n_], n_);
 }
 
 void DenseMatrix::addRowToVector(Vector& x, int32_t i, real a) const {
   assert(i >= 0);
   assert(i < this->size(0));
   assert(x.size() == this->size(1));
-  for (int64_t j = 0; j < n_; j++) {
-    x[j] += a * at(i, j);
-  }
+  kernels::addScaled(x.data(), &data_[i * n_], a, n_);
 }
 
 void DenseMatrix::save(std::ostream& out) const {
@@ -67,6 +67,13 @@ class DenseMatrix : public Matrix {
   void l2NormRow(Vector& norms) const;
 
   real dotRow(const Vector&, int64_t) const override;
+  void dotRows(const Vector&, Vector& out) const override;
+  void dotRows(const real* x, int64_t m, real* out) const override;
+  void dotRowPairs(
+      const real* const* x,
+      const int64_t* rows,
+      int64_t n,
+      real* out) const override;
   void addVectorToRow(const Vector&, int64_t, real) override;
   void addRowToVector(Vector& x, int32_t i) const override;
   void addRowToVector(Vector& x, int32_t i, real a) const override;
@@ -11,21 +11,38 @@
 #include <assert.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstring>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <stdexcept>
+#include <thread>
+
+#include "corpus.h"
+#include "utils.h"
 
 namespace fasttext {
 
+namespace {
+
+// characters ending a token in readWord
+bool isSeparator(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' ||
+      c == '\f' || c == '\0';
+}
+
+} // namespace
+
 const std::string Dictionary::EOS = "</s>";
 const std::string Dictionary::BOW = "<";
 const std::string Dictionary::EOW = ">";
 
 Dictionary::Dictionary(std::shared_ptr<Args> args)
     : args_(args),
-      word2int_(MAX_VOCAB_SIZE, -1),
       size_(0),
       nwords_(0),
       nlabels_(0),
@@ -47,26 +64,26 @@ int32_t Dictionary::find(const std::string& w) const {
 }
 
 int32_t Dictionary::find(const std::string& w, uint32_t h) const {
-  int32_t word2intsize = word2int_.size();
-  int32_t id = h % word2intsize;
-  while (word2int_[id] != -1 && words_[word2int_[id]].word != w) {
-    id = (id + 1) % word2intsize;
-  }
-  return id;
+  return find(TextSpan{w.data(), w.size()}, h);
+}
+
+int32_t Dictionary::find(const TextSpan& w, uint32_t h) const {
+  return wordTable_.find(w, h);
 }
 
 void Dictionary::add(const std::string& w) {
-  int32_t h = find(w);
+  uint32_t h = hash(w);
+  int32_t id = find(w, h);
   ntokens_++;
-  if (word2int_[h] == -1) {
+  if (id == -1) {
     entry e;
-    e.word = w;
     e.count = 1;
     e.type = getType(w);
     words_.push_back(e);
-    word2int_[h] = size_++;
+    wordTable_.insert(TextSpan{w.data(), w.size()}, h);
+    size_++;
   } else {
-    words_[word2int_[h]].count++;
+    words_[id].count++;
   }
 }
 
@@ -110,7 +127,7 @@ void Dictionary::getSubwords(
   substrings.clear();
   if (i >= 0) {
     ngrams.push_back(i);
-    substrings.push_back(words_[i].word);
+    substrings.push_back(getWord(i));
   }
   if (word != EOS) {
     computeSubwords(BOW + word + EOW, ngrams, &substrings);
@@ -127,13 +144,15 @@ bool Dictionary::discard(int32_t id, real rand) const {
 }
 
 int32_t Dictionary::getId(const std::string& w, uint32_t h) const {
-  int32_t id = find(w, h);
-  return word2int_[id];
+  return find(w, h);
+}
+
+int32_t Dictionary::getId(const TextSpan& w, uint32_t h) const {
+  return find(w, h);
 }
 
 int32_t Dictionary::getId(const std::string& w) const {
-  int32_t h = find(w);
-  return word2int_[h];
+  return find(w);
 }
 
 entry_type Dictionary::getType(int32_t id) const {
@@ -146,10 +165,19 @@ entry_type Dictionary::getType(const std::string& w) const {
   return (w.find(args_->label) == 0) ? entry_type::label : entry_type::word;
 }
 
+entry_type Dictionary::getType(const TextSpan& w) const {
+  const std::string& label = args_->label;
+  return (w.size >= label.size() &&
+          std::memcmp(w.data, label.data(), label.size()) == 0)
+      ? entry_type::label
+      : entry_type::word;
+}
+
 std::string Dictionary::getWord(int32_t id) const {
   assert(id >= 0);
   assert(id < size_);
-  return words_[id].word;
+  TextSpan word = wordTable_.word(id);
+  return std::string(word.data, word.size);
 }
 
 // The correct implementation of fnv should be:
@@ -161,10 +189,13 @@ std::string Dictionary::getWord(int32_t id) const {
 // using signed char, we fixed the hash function to make models
 // compatible whatever compiler is used.
 uint32_t Dictionary::hash(const std::string& str) const {
-  uint32_t h = 2166136261;
-  for (size_t i = 0; i < str.size(); i++) {
-    h = h ^ uint32_t(int8_t(str[i]));
-    h = h * 16777619;
+  return hash(str.data(), str.size());
+}
+
+uint32_t Dictionary::hash(const char* str, size_t size) const {
+  uint32_t h = hashInit();
+  for (size_t i = 0; i < size; i++) {
+    h = hashStep(h, str[i]);
   }
   return h;
 }
@@ -173,19 +204,44 @@ void Dictionary::computeSubwords(
     const std::string& word,
     std::vector<int32_t>& ngrams,
     std::vector<std::string>* substrings) const {
-  for (size_t i = 0; i < word.size(); i++) {
-    std::string ngram;
-    if ((word[i] & 0xC0) == 0x80) {
+  computeSubwords(TextSpan{word.data(), word.size()}, false, ngrams, substrings);
+}
+
+// Character n-grams of word, or of BOW + word + EOW when bracketed. The hash
+// of each n-gram extends the hash of the previous one (with the same start),
+// strings are only built if substrings are requested.
+void Dictionary::computeSubwords(
+    const TextSpan& word,
+    bool bracketed,
+    std::vector<int32_t>& ngrams,
+    std::vector<std::string>* substrings) const {
+  assert(BOW.size() == 1 && EOW.size() == 1);
+  const size_t size = bracketed ? word.size + 2 : word.size;
+  auto at = [&](size_t k) -> char {
+    if (!bracketed) {
+      return word.data[k];
+    }
+    return k == 0 ? BOW[0] : (k == size - 1 ? EOW[0] : word.data[k - 1]);
+  };
+  std::string ngram;
+  for (size_t i = 0; i < size; i++) {
+    if ((at(i) & 0xC0) == 0x80) {
       continue;
     }
-    for (size_t j = i, n = 1; j < word.size() && n <= args_->maxn; n++) {
-      ngram.push_back(word[j++]);
-      while (j < word.size() && (word[j] & 0xC0) == 0x80) {
-        ngram.push_back(word[j++]);
-      }
-      if (n >= args_->minn && !(n == 1 && (i == 0 || j == word.size()))) {
-        int32_t h = hash(ngram) % args_->bucket;
-        pushHash(ngrams, h);
+    uint32_t h = hashInit();
+    ngram.clear();
+    size_t j = i;
+    for (int32_t n = 1; j < size && n <= args_->maxn; n++) {
+      do {
+        h = hashStep(h, at(j));
+        if (substrings) {
+          ngram.push_back(at(j));
+        }
+        j++;
+      } while (j < size && (at(j) & 0xC0) == 0x80);
+      if (n >= args_->minn && !(n == 1 && (i == 0 || j == size))) {
+        int32_t id = h % args_->bucket;
+        pushHash(ngrams, id);
         if (substrings) {
           substrings->push_back(ngram);
         }
@@ -196,11 +252,11 @@ void Dictionary::computeSubwords(
 
 void Dictionary::initNgrams() {
   for (size_t i = 0; i < size_; i++) {
-    std::string word = BOW + words_[i].word + EOW;
+    TextSpan word = wordTable_.word(i);
     words_[i].subwords.clear();
     words_[i].subwords.push_back(i);
-    if (words_[i].word != EOS) {
-      computeSubwords(word, words_[i].subwords);
+    if (!isEOS(word)) {
+      computeSubwords(word, true, words_[i].subwords, nullptr);
     }
   }
 }
@@ -210,8 +266,7 @@ bool Dictionary::readWord(std::istream& in, std::string& word) const {
   std::streambuf& sb = *in.rdbuf();
   word.clear();
   while ((c = sb.sbumpc()) != EOF) {
-    if (c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' ||
-        c == '\f' || c == '\0') {
+    if (isSeparator(c)) {
       if (word.empty()) {
         if (c == '\n') {
           word += EOS;
@@ -231,19 +286,263 @@ bool Dictionary::readWord(std::istream& in, std::string& word) const {
   return !word.empty();
 }
 
+bool Dictionary::readWord(
+    const char*& begin,
+    const char* end,
+    std::string& word) const {
+  word.clear();
+  while (begin != end) {
+    char c = *begin++;
+    if (isSeparator(c)) {
+      if (word.empty()) {
+        if (c == '\n') {
+          word += EOS;
+          return true;
+        }
+        continue;
+      } else {
+        if (c == '\n')
+          begin--;
+        return true;
+      }
+    }
+    word.push_back(c);
+  }
+  return !word.empty();
+}
+
+bool Dictionary::readWord(
+    const char*& begin,
+    const char* end,
+    TextSpan& token,
+    uint32_t& h) const {
+  const char* start = nullptr;
+  h = hashInit();
+  while (begin != end) {
+    char c = *begin;
+    if (isSeparator(c)) {
+      if (!start) {
+        begin++;
+        if (c == '\n') {
+          token = TextSpan{EOS.data(), EOS.size()};
+          h = hash(EOS);
+          return true;
+        }
+        continue;
+      }
+      token = TextSpan{start, size_t(begin - start)};
+      // a new line ends the token, and is read again as EOS
+      if (c != '\n') {
+        begin++;
+      }
+      return true;
+    }
+    if (!start) {
+      start = begin;
+    }
+    h = hashStep(h, c);
+    begin++;
+  }
+  if (start) {
+    token = TextSpan{start, size_t(begin - start)};
+    return true;
+  }
+  return false;
+}
+
+bool Dictionary::isEOS(const TextSpan& token) {
+  return token.size == EOS.size() &&
+      std::memcmp(token.data, EOS.data(), EOS.size()) == 0;
+}
+
+int32_t Dictionary::readDocument(
+    const DocumentSource& source,
+    int64_t i,
+    std::vector<std::string>& tokens) const {
+  // strings are reused from one document to the next to avoid allocations
+  size_t ntokens = 0;
+  auto next = [&]() -> std::string& {
+    if (ntokens == tokens.size()) {
+      tokens.emplace_back();
+    }
+    return tokens[ntokens];
+  };
+  for (const TextSpan& span : {source.labels(i), source.text(i)}) {
+    const char* begin = span.data;
+    const char* end = span.data + span.size;
+    while (begin != end && readWord(begin, end, next())) {
+      ntokens++;
+    }
+  }
+  next() = EOS;
+  return ++ntokens;
+}
+
+void Dictionary::countWord(const std::string& word, int64_t& minThreshold) {
+  add(word);
+  if (ntokens_ % 1000000 == 0 && args_->verbose > 1) {
+    std::cerr << "\rRead " << ntokens_ / 1000000 << "M words" << std::flush;
+  }
+  if (size_ > 0.75 * MAX_VOCAB_SIZE) {
+    minThreshold++;
+    threshold(minThreshold, minThreshold);
+  }
+}
+
 void Dictionary::readFromFile(std::istream& in) {
   std::string word;
   int64_t minThreshold = 1;
   while (readWord(in, word)) {
-    add(word);
-    if (ntokens_ % 1000000 == 0 && args_->verbose > 1) {
-      std::cerr << "\rRead " << ntokens_ / 1000000 << "M words" << std::flush;
+    countWord(word, minThreshold);
+  }
+  initFromCounts();
+}
+
+void Dictionary::readFromFile(const std::string& filename, int32_t nthreads) {
+  std::ifstream in(filename);
+  if (!in.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for training!");
+  }
+  const int64_t size = utils::size(in);
+  // range i starts at the beginning of the first line starting at or after
+  // i * size / nthreads
+  std::vector<int64_t> bounds(nthreads + 1, size);
+  bounds[0] = 0;
+  for (int32_t i = 1; i < nthreads; i++) {
+    int64_t pos = i * size / nthreads;
+    if (pos > 0) {
+      utils::seek(in, pos - 1);
+      in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+      pos = in.eof() ? size : int64_t(in.tellg());
     }
-    if (size_ > 0.75 * MAX_VOCAB_SIZE) {
-      minThreshold++;
-      threshold(minThreshold, minThreshold);
+    bounds[i] = std::max(bounds[i - 1], pos);
+  }
+  in.close();
+
+  // a shard stops counting above 0.75 * MAX_VOCAB_SIZE distinct tokens, a
+  // size the single threaded pass would also reach and prune
+  std::atomic<bool> overflow(false);
+  std::vector<Shard> shards(nthreads);
+  std::vector<std::exception_ptr> errors(nthreads);
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < nthreads; i++) {
+    threads.push_back(std::thread([&, i]() {
+      try {
+        countRange(filename, bounds[i], bounds[i + 1], overflow, shards[i]);
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    }));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (int32_t i = 0; i < nthreads; i++) {
+    if (errors[i]) {
+      std::rethrow_exception(errors[i]);
     }
   }
+  // shards are merged in the order of the file, so that words are added in
+  // the same order as readFromFile
+  for (int32_t i = 0; i < nthreads && !overflow; i++) {
+    overflow = !addShard(shards[i]);
+    shards[i] = Shard();
+  }
+  if (overflow) {
+    // the rare tokens would have been pruned while reading, which depends on
+    // the order of the tokens: the file is read again by a single thread
+    shards.clear();
+    wordTable_.clear();
+    words_.clear();
+    size_ = 0;
+    ntokens_ = 0;
+    std::ifstream ifs(filename);
+    readFromFile(ifs);
+    return;
+  }
+  initFromCounts();
+}
+
+void Dictionary::countRange(
+    const std::string& filename,
+    int64_t begin,
+    int64_t end,
+    std::atomic<bool>& overflow,
+    Shard& shard) const {
+  const int64_t kBlockSize = 1 << 20;
+  std::ifstream in(filename, std::ifstream::binary);
+  utils::seek(in, begin);
+  std::vector<char> buffer;
+  size_t carry = 0;
+  TextSpan token;
+  uint32_t h;
+  for (int64_t pos = begin; pos < end && !overflow;) {
+    const int64_t n = std::min(kBlockSize, end - pos);
+    buffer.resize(carry + n);
+    in.read(buffer.data() + carry, n);
+    if (in.gcount() != n) {
+      throw std::runtime_error("Error while reading " + filename);
+    }
+    pos += n;
+    // a token may continue in the next block, the block is only read up to
+    // its last separator
+    const char* first = buffer.data();
+    const char* last = first + buffer.size();
+    if (pos < end) {
+      while (last != first && !isSeparator(last[-1])) {
+        last--;
+      }
+    }
+    while (readWord(first, last, token, h)) {
+      int32_t id = shard.words.find(token, h);
+      if (id == -1) {
+        id = shard.words.insert(token, h);
+        shard.counts.push_back(0);
+      }
+      shard.counts[id]++;
+      shard.ntokens++;
+    }
+    carry = buffer.data() + buffer.size() - last;
+    std::copy(last, last + carry, buffer.data());
+    if (shard.words.size() > 0.75 * MAX_VOCAB_SIZE) {
+      overflow = true;
+    }
+  }
+}
+
+bool Dictionary::addShard(const Shard& shard) {
+  for (int32_t i = 0; i < shard.words.size(); i++) {
+    const TextSpan word = shard.words.word(i);
+    const uint32_t h = shard.words.hash(i);
+    int32_t id = find(word, h);
+    if (id == -1) {
+      entry e;
+      e.count = shard.counts[i];
+      e.type = getType(word);
+      words_.push_back(e);
+      wordTable_.insert(word, h);
+      size_++;
+    } else {
+      words_[id].count += shard.counts[i];
+    }
+  }
+  ntokens_ += shard.ntokens;
+  return size_ <= 0.75 * MAX_VOCAB_SIZE;
+}
+
+void Dictionary::readFromSource(const DocumentSource& source) {
+  std::vector<std::string> tokens;
+  int64_t minThreshold = 1;
+  for (int64_t i = 0; i < source.size(); i++) {
+    int32_t ntokens = readDocument(source, i, tokens);
+    for (int32_t j = 0; j < ntokens; j++) {
+      countWord(tokens[j], minThreshold);
+    }
+  }
+  initFromCounts();
+}
+
+void Dictionary::initFromCounts() {
   threshold(args_->minCount, args_->minCountLabel);
   initTableDiscard();
   initNgrams();
@@ -259,36 +558,56 @@ void Dictionary::readFromFile(std::istream& in) {
 }
 
 void Dictionary::threshold(int64_t t, int64_t tl) {
-  sort(words_.begin(), words_.end(), [](const entry& e1, const entry& e2) {
+  std::vector<int32_t> ids(words_.size());
+  for (size_t i = 0; i < ids.size(); i++) {
+    ids[i] = i;
+  }
+  sort(ids.begin(), ids.end(), [&](int32_t i1, int32_t i2) {
+    const entry& e1 = words_[i1];
+    const entry& e2 = words_[i2];
     if (e1.type != e2.type) {
       return e1.type < e2.type;
     }
     return e1.count > e2.count;
   });
-  words_.erase(
+  ids.erase(
       remove_if(
-          words_.begin(),
-          words_.end(),
-          [&](const entry& e) {
+          ids.begin(),
+          ids.end(),
+          [&](int32_t i) {
+            const entry& e = words_[i];
             return (e.type == entry_type::word && e.count < t) ||
                 (e.type == entry_type::label && e.count < tl);
           }),
-      words_.end());
-  words_.shrink_to_fit();
+      ids.end());
+  keepWords(ids);
+}
+
+void Dictionary::keepWords(const std::vector<int32_t>& ids) {
+  int64_t nchars = 0;
+  for (int32_t i : ids) {
+    nchars += wordTable_.word(i).size;
+  }
+  WordTable wordTable;
+  std::vector<entry> words;
+  wordTable.reserve(ids.size(), nchars);
+  words.reserve(ids.size());
   size_ = 0;
   nwords_ = 0;
   nlabels_ = 0;
-  std::fill(word2int_.begin(), word2int_.end(), -1);
-  for (auto it = words_.begin(); it != words_.end(); ++it) {
-    int32_t h = find(it->word);
-    word2int_[h] = size_++;
-    if (it->type == entry_type::word) {
+  for (int32_t i : ids) {
+    wordTable.insert(wordTable_.word(i), wordTable_.hash(i));
+    words.push_back(std::move(words_[i]));
+    size_++;
+    if (words.back().type == entry_type::word) {
       nwords_++;
     }
-    if (it->type == entry_type::label) {
+    if (words.back().type == entry_type::label) {
       nlabels_++;
     }
   }
+  std::swap(wordTable_, wordTable);
+  std::swap(words_, words);
 }
 
 void Dictionary::initTableDiscard() {
@@ -322,6 +641,32 @@ void Dictionary::addWordNgrams(
   }
 }
 
+void Dictionary::getSubwords(
+    const TextSpan& word,
+    uint32_t h,
+    std::vector<int32_t>& ngrams) const {
+  ngrams.clear();
+  addSubwords(ngrams, word, getId(word, h));
+}
+
+void Dictionary::addSubwords(
+    std::vector<int32_t>& line,
+    const TextSpan& token,
+    int32_t wid) const {
+  if (wid < 0) { // out of vocab
+    if (!isEOS(token)) {
+      computeSubwords(token, true, line, nullptr);
+    }
+  } else {
+    if (args_->maxn <= 0) { // in vocab w/o subwords
+      line.push_back(wid);
+    } else { // in vocab w/ subwords
+      const std::vector<int32_t>& ngrams = getSubwords(wid);
+      line.insert(line.end(), ngrams.cbegin(), ngrams.cend());
+    }
+  }
+}
+
 void Dictionary::addSubwords(
     std::vector<int32_t>& line,
     const std::string& token,
@@ -358,8 +703,7 @@ int32_t Dictionary::getLine(
   reset(in);
   words.clear();
   while (readWord(in, token)) {
-    int32_t h = find(token);
-    int32_t wid = word2int_[h];
+    int32_t wid = getId(token);
     if (wid < 0) {
       continue;
     }
@@ -406,6 +750,102 @@ int32_t Dictionary::getLine(
   return ntokens;
 }
 
+int32_t Dictionary::getLine(
+    const char*& begin,
+    const char* end,
+    std::vector<int32_t>& words,
+    std::vector<int32_t>& labels,
+    std::vector<int32_t>& wordHashes) const {
+  TextSpan token;
+  uint32_t h;
+  int32_t ntokens = 0;
+
+  words.clear();
+  labels.clear();
+  wordHashes.clear();
+  while (readWord(begin, end, token, h)) {
+    int32_t wid = getId(token, h);
+    entry_type type = wid < 0 ? getType(token) : getType(wid);
+
+    ntokens++;
+    if (type == entry_type::word) {
+      addSubwords(words, token, wid);
+      wordHashes.push_back(h);
+    } else if (type == entry_type::label && wid >= 0) {
+      labels.push_back(wid - nwords_);
+    }
+    if (isEOS(token)) {
+      break;
+    }
+  }
+  addWordNgrams(words, wordHashes, args_->wordNgrams);
+  return ntokens;
+}
+
+int32_t Dictionary::getLine(
+    const Corpus& corpus,
+    int64_t& pos,
+    std::vector<int32_t>& words,
+    std::minstd_rand& rng) const {
+  std::uniform_real_distribution<> uniform(0, 1);
+  int32_t ntokens = 0;
+
+  if (pos >= corpus.size()) {
+    pos = 0;
+  }
+  words.clear();
+  while (pos < corpus.size()) {
+    int32_t wid = corpus[pos++];
+
+    ntokens++;
+    if (getType(wid) == entry_type::word && !discard(wid, uniform(rng))) {
+      words.push_back(wid);
+    }
+    if (ntokens > MAX_LINE_SIZE || wid == corpus.eos()) {
+      break;
+    }
+  }
+  return ntokens;
+}
+
+int32_t Dictionary::getLine(
+    const Corpus& corpus,
+    int64_t& pos,
+    std::vector<int32_t>& words,
+    std::vector<int32_t>& labels) const {
+  std::vector<int32_t> word_hashes;
+  int32_t ntokens = 0;
+
+  if (pos >= corpus.size()) {
+    pos = 0;
+  }
+  words.clear();
+  labels.clear();
+  while (pos < corpus.size()) {
+    int32_t wid = corpus[pos++];
+
+    ntokens++;
+    if (corpus.isWord(wid, nwords_)) {
+      if (wid < 0) {
+        corpus.addUnknownSubwords(words, wid);
+      } else if (args_->maxn <= 0) {
+        words.push_back(wid);
+      } else {
+        const std::vector<int32_t>& ngrams = getSubwords(wid);
+        words.insert(words.end(), ngrams.cbegin(), ngrams.cend());
+      }
+      word_hashes.push_back(corpus.hash(wid));
+    } else if (wid >= nwords_) {
+      labels.push_back(wid - nwords_);
+    }
+    if (wid == corpus.eos()) {
+      break;
+    }
+  }
+  addWordNgrams(words, word_hashes, args_->wordNgrams);
+  return ntokens;
+}
+
 void Dictionary::pushHash(std::vector<int32_t>& hashes, int32_t id) const {
   if (pruneidx_size_ == 0 || id < 0) {
     return;
@@ -425,7 +865,7 @@ std::string Dictionary::getLabel(int32_t lid) const {
     throw std::invalid_argument(
         "Label id is out of range [0, " + std::to_string(nlabels_) + "]");
   }
-  return words_[lid + nwords_].word;
+  return getWord(lid + nwords_);
 }
 
 void Dictionary::save(std::ostream& out) const {
@@ -435,8 +875,9 @@ void Dictionary::save(std::ostream& out) const {
   out.write((char*)&ntokens_, sizeof(int64_t));
   out.write((char*)&pruneidx_size_, sizeof(int64_t));
   for (int32_t i = 0; i < size_; i++) {
-    entry e = words_[i];
-    out.write(e.word.data(), e.word.size() * sizeof(char));
+    const entry& e = words_[i];
+    TextSpan word = wordTable_.word(i);
+    out.write(word.data, word.size * sizeof(char));
     out.put(0);
     out.write((char*)&(e.count), sizeof(int64_t));
     out.write((char*)&(e.type), sizeof(entry_type));
@@ -449,20 +890,26 @@ void Dictionary::save(std::ostream& out) const {
 
 void Dictionary::load(std::istream& in) {
   words_.clear();
+  wordTable_.clear();
   in.read((char*)&size_, sizeof(int32_t));
   in.read((char*)&nwords_, sizeof(int32_t));
   in.read((char*)&nlabels_, sizeof(int32_t));
   in.read((char*)&ntokens_, sizeof(int64_t));
   in.read((char*)&pruneidx_size_, sizeof(int64_t));
+  words_.reserve(size_);
+  wordTable_.reserve(size_, 0);
+  std::string word;
   for (int32_t i = 0; i < size_; i++) {
     char c;
     entry e;
+    word.clear();
     while ((c = in.get()) != 0) {
-      e.word.push_back(c);
+      word.push_back(c);
     }
     in.read((char*)&e.count, sizeof(int64_t));
     in.read((char*)&e.type, sizeof(entry_type));
     words_.push_back(e);
+    wordTable_.insert(TextSpan{word.data(), word.size()}, hash(word));
   }
   pruneidx_.clear();
   for (int32_t i = 0; i < pruneidx_size_; i++) {
@@ -474,12 +921,6 @@ void Dictionary::load(std::istream& in) {
   }
   initTableDiscard();
   initNgrams();
-
-  int32_t word2intsize = std::ceil(size_ / 0.7);
-  word2int_.assign(word2intsize, -1);
-  for (int32_t i = 0; i < size_; i++) {
-    word2int_[find(words_[i].word)] = i;
-  }
 }
 
 void Dictionary::init() {
@@ -509,31 +950,28 @@ void Dictionary::prune(std::vector<int32_t>& idx) {
   }
   pruneidx_size_ = pruneidx_.size();
 
-  std::fill(word2int_.begin(), word2int_.end(), -1);
-
+  std::vector<int32_t> ids;
   int32_t j = 0;
   for (int32_t i = 0; i < words_.size(); i++) {
     if (getType(i) == entry_type::label ||
         (j < words.size() && words[j] == i)) {
-      words_[j] = words_[i];
-      word2int_[find(words_[j].word)] = j;
+      ids.push_back(i);
       j++;
     }
   }
-  nwords_ = words.size();
-  size_ = nwords_ + nlabels_;
-  words_.erase(words_.begin() + size_, words_.end());
+  keepWords(ids);
   initNgrams();
 }
 
 void Dictionary::dump(std::ostream& out) const {
   out << words_.size() << std::endl;
-  for (auto it : words_) {
+  for (int32_t i = 0; i < size_; i++) {
     std::string entryType = "word";
-    if (it.type == entry_type::label) {
+    if (words_[i].type == entry_type::label) {
       entryType = "label";
     }
-    out << it.word << " " << it.count << " " << entryType << std::endl;
+    out << getWord(i) << " " << words_[i].count << " " << entryType
+        << std::endl;
   }
 }
 
@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <istream>
 #include <memory>
 #include <ostream>
@@ -18,14 +19,18 @@
 
 #include "args.h"
 #include "real.h"
+#include "wordtable.h"
 
 namespace fasttext {
 
+class Corpus;
+class DocumentSource;
+
 typedef int32_t id_type;
 enum class entry_type : int8_t { word = 0, label = 1 };
 
+// the characters of the word are kept by the WordTable of the dictionary
 struct entry {
-  std::string word;
   int64_t count;
   entry_type type;
   std::vector<int32_t> subwords;
@@ -36,16 +41,43 @@ class Dictionary {
   static const int32_t MAX_VOCAB_SIZE = 30000000;
   static const int32_t MAX_LINE_SIZE = 1024;
 
+  // id of a word, -1 if it is not in the dictionary
   int32_t find(const std::string&) const;
   int32_t find(const std::string&, uint32_t h) const;
+  int32_t find(const TextSpan&, uint32_t h) const;
   void initTableDiscard();
   void initNgrams();
   void reset(std::istream&) const;
+  void countWord(const std::string&, int64_t&);
+  void initFromCounts();
+
+  // token counts of a range of a file, in the order of first occurrence
+  struct Shard {
+    WordTable words;
+    std::vector<int64_t> counts;
+    int64_t ntokens = 0;
+  };
+  void countRange(
+      const std::string& filename,
+      int64_t begin,
+      int64_t end,
+      std::atomic<bool>& overflow,
+      Shard& shard) const;
+  // false once the dictionary has more than 0.75 * MAX_VOCAB_SIZE tokens
+  bool addShard(const Shard& shard);
+  // keeps the given words, in this order
+  void keepWords(const std::vector<int32_t>&);
   void pushHash(std::vector<int32_t>&, int32_t) const;
   void addSubwords(std::vector<int32_t>&, const std::string&, int32_t) const;
+  void addSubwords(std::vector<int32_t>&, const TextSpan&, int32_t) const;
+  void computeSubwords(
+      const TextSpan& word,
+      bool bracketed,
+      std::vector<int32_t>& ngrams,
+      std::vector<std::string>* substrings) const;
 
   std::shared_ptr<Args> args_;
-  std::vector<int32_t> word2int_;
+  WordTable wordTable_;
   std::vector<entry> words_;
 
   std::vector<real> pdiscard_;
@@ -73,8 +105,10 @@ class Dictionary {
   int64_t ntokens() const;
   int32_t getId(const std::string&) const;
   int32_t getId(const std::string&, uint32_t h) const;
+  int32_t getId(const TextSpan&, uint32_t h) const;
   entry_type getType(int32_t) const;
   entry_type getType(const std::string&) const;
+  entry_type getType(const TextSpan&) const;
   bool discard(int32_t, real) const;
   std::string getWord(int32_t) const;
   const std::vector<int32_t>& getSubwords(int32_t) const;
@@ -83,14 +117,45 @@ class Dictionary {
       const std::string&,
       std::vector<int32_t>&,
       std::vector<std::string>&) const;
+  // ids of the subwords of a token of hash h (as given by readWord): the
+  // same as getSubwords(std::string), without copying the token
+  void getSubwords(const TextSpan&, uint32_t h, std::vector<int32_t>&) const;
   void computeSubwords(
       const std::string&,
       std::vector<int32_t>&,
       std::vector<std::string>* substrings = nullptr) const;
   uint32_t hash(const std::string& str) const;
+  uint32_t hash(const char* str, size_t size) const;
+  static inline uint32_t hashInit() {
+    return 2166136261;
+  }
+  // see hash for the cast of the character
+  static inline uint32_t hashStep(uint32_t h, char c) {
+    return (h ^ uint32_t(int8_t(c))) * 16777619;
+  }
   void add(const std::string&);
   bool readWord(std::istream&, std::string&) const;
+  bool readWord(const char*&, const char*, std::string&) const;
+  // Reads the next token of [begin, end) without copying it: token points
+  // into the buffer (or to EOS at the end of a line) and h is its hash,
+  // computed while the token is read.
+  bool readWord(
+      const char*& begin,
+      const char* end,
+      TextSpan& token,
+      uint32_t& h) const;
+  static bool isEOS(const TextSpan&);
+  int32_t readDocument(
+      const DocumentSource&,
+      int64_t,
+      std::vector<std::string>&) const;
   void readFromFile(std::istream&);
+  // Same dictionary as readFromFile, the file being split in nthreads ranges
+  // of lines whose tokens are counted in parallel then merged in order. Files
+  // with more than 0.75 * MAX_VOCAB_SIZE distinct tokens, whose rare tokens
+  // are pruned while reading, are read again by readFromFile(std::istream&).
+  void readFromFile(const std::string& filename, int32_t nthreads);
+  void readFromSource(const DocumentSource&);
   std::string getLabel(int32_t) const;
   void save(std::ostream&) const;
   void load(std::istream&);
@@ -99,6 +164,25 @@ class Dictionary {
       const;
   int32_t getLine(std::istream&, std::vector<int32_t>&, std::minstd_rand&)
       const;
+  // getLine on the first line of [begin, end), begin is moved after it.
+  // Tokens are never copied: words, labels and wordHashes (a scratch
+  // buffer) are owned by the caller and reused from one call to the next.
+  int32_t getLine(
+      const char*& begin,
+      const char* end,
+      std::vector<int32_t>& words,
+      std::vector<int32_t>& labels,
+      std::vector<int32_t>& wordHashes) const;
+  int32_t getLine(
+      const Corpus&,
+      int64_t&,
+      std::vector<int32_t>&,
+      std::vector<int32_t>&) const;
+  int32_t getLine(
+      const Corpus&,
+      int64_t&,
+      std::vector<int32_t>&,
+      std::minstd_rand&) const;
   void threshold(int64_t, int64_t);
   void prune(std::vector<int32_t>&);
   bool isPruned() {
@@ -8,11 +8,15 @@
 
 #include "fasttext.h"
 #include "loss.h"
+#include "mappedmatrix.h"
 #include "quantmatrix.h"
 
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <numeric>
 #include <sstream>
 #include <stdexcept>
@@ -24,6 +28,98 @@ namespace fasttext {
 
 constexpr int32_t FASTTEXT_VERSION = 12; /* Version 1b */
 constexpr int32_t FASTTEXT_FILEFORMAT_MAGIC_INT32 = 793712314;
+// binary word vectors: magic and version (int32), n and dim (int64), the
+// n x dim matrix of float32 (at byte 24, it can be memory mapped) then the n
+// words, each terminated by a null character
+constexpr int32_t VECTORS_VERSION = 1;
+constexpr int32_t VECTORS_FILEFORMAT_MAGIC_INT32 = 793712315;
+
+namespace {
+
+constexpr int32_t kMaxFastDigits = 10;
+constexpr double kPowersOf10[kMaxFastDigits + 1] =
+    {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10};
+
+// white spaces of a line, as skipped by operator>> of a stream
+inline bool isBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+// Parses the next number of the current line of [pos, end). Numbers written
+// with at most 7 significant digits and 10 decimals without exponent (as in
+// .vec files) are computed from their digits: the quotient of two floats
+// rounded through a double is correctly rounded, hence the same as strtof
+// which is used for the other ones.
+bool parseReal(const char*& pos, const char* end, real& value) {
+  while (pos < end && isBlank(*pos)) {
+    pos++;
+  }
+  const char* begin = pos;
+  while (pos < end && !isBlank(*pos) && *pos != '\n') {
+    pos++;
+  }
+  if (begin == pos) {
+    return false;
+  }
+  const char* s = begin;
+  const bool negative = (*s == '-');
+  if (*s == '-' || *s == '+') {
+    s++;
+  }
+  uint64_t mantissa = 0;
+  int32_t ndigits = 0, ndecimals = 0;
+  for (; s < pos && isDigit(*s); s++, ndigits++) {
+    mantissa = 10 * mantissa + (*s - '0');
+  }
+  if (s < pos && *s == '.') {
+    for (s++; s < pos && isDigit(*s); s++, ndigits++, ndecimals++) {
+      mantissa = 10 * mantissa + (*s - '0');
+    }
+  }
+  if (s == pos && ndigits > 0 && ndigits <= 18 && mantissa <= (1 << 24) &&
+      ndecimals <= kMaxFastDigits) {
+    value = real(double(mantissa) / kPowersOf10[ndecimals]);
+    if (negative) {
+      value = -value;
+    }
+    return true;
+  }
+  const std::string number(begin, pos);
+  char* last;
+  value = std::strtof(number.c_str(), &last);
+  return last == number.c_str() + number.size();
+}
+
+void writeVectorsHeader(std::ostream& out, int64_t n, int64_t dim) {
+  out.write((char*)&(VECTORS_FILEFORMAT_MAGIC_INT32), sizeof(int32_t));
+  out.write((char*)&(VECTORS_VERSION), sizeof(int32_t));
+  out.write((char*)&n, sizeof(int64_t));
+  out.write((char*)&dim, sizeof(int64_t));
+}
+
+// false if the stream does not start with the header of binary vectors
+bool readVectorsHeader(std::istream& in, int64_t& n, int64_t& dim) {
+  int32_t magic, version;
+  in.read((char*)&magic, sizeof(int32_t));
+  in.read((char*)&version, sizeof(int32_t));
+  in.read((char*)&n, sizeof(int64_t));
+  in.read((char*)&dim, sizeof(int64_t));
+  return in && magic == VECTORS_FILEFORMAT_MAGIC_INT32 &&
+      version <= VECTORS_VERSION && n >= 0 && dim >= 0;
+}
+
+void writeVectorsWords(std::ostream& out, const Dictionary& dict) {
+  for (int32_t i = 0; i < dict.nwords(); i++) {
+    const std::string word = dict.getWord(i);
+    out.write(word.c_str(), word.size() + 1);
+  }
+}
+
+} // namespace
 
 bool comparePairs(
     const std::pair<real, std::string>& l,
@@ -34,10 +130,10 @@ std::shared_ptr<Loss> FastText::createLoss(std::shared_ptr<Matrix>& output) {
   switch (lossName) {
     case loss_name::hs:
       return std::make_shared<HierarchicalSoftmaxLoss>(
-          output, getTargetCounts());
+          output, getTargetCounts(), !inferenceOnly_);
     case loss_name::ns:
       return std::make_shared<NegativeSamplingLoss>(
-          output, args_->neg, getTargetCounts());
+          output, args_->neg, getTargetCounts(), !inferenceOnly_);
     case loss_name::softmax:
       return std::make_shared<SoftmaxLoss>(output);
     case loss_name::ova:
@@ -48,7 +144,10 @@ std::shared_ptr<Loss> FastText::createLoss(std::shared_ptr<Matrix>& output) {
 }
 
 FastText::FastText()
-    : quant_(false), wordVectors_(nullptr), trainException_(nullptr) {}
+    : quant_(false),
+      inferenceOnly_(false),
+      wordVectors_(nullptr),
+      trainException_(nullptr) {}
 
 void FastText::addInputVector(Vector& vec, int32_t ind) const {
   vec.addRow(*input_, ind);
@@ -67,7 +166,12 @@ std::shared_ptr<const DenseMatrix> FastText::getInputMatrix() const {
     throw std::runtime_error("Can't export quantized matrix");
   }
   assert(input_.get());
-  return std::dynamic_pointer_cast<DenseMatrix>(input_);
+  std::shared_ptr<DenseMatrix> input =
+      std::dynamic_pointer_cast<DenseMatrix>(input_);
+  if (!input) {
+    throw std::runtime_error("Can't export memory mapped matrix");
+  }
+  return input;
 }
 
 std::shared_ptr<const DenseMatrix> FastText::getOutputMatrix() const {
@@ -75,7 +179,12 @@ std::shared_ptr<const DenseMatrix> FastText::getOutputMatrix() const {
     throw std::runtime_error("Can't export quantized matrix");
   }
   assert(output_.get());
-  return std::dynamic_pointer_cast<DenseMatrix>(output_);
+  std::shared_ptr<DenseMatrix> output =
+      std::dynamic_pointer_cast<DenseMatrix>(output_);
+  if (!output) {
+    throw std::runtime_error("Can't export memory mapped matrix");
+  }
+  return output;
 }
 
 int32_t FastText::getWordId(const std::string& word) const {
@@ -105,21 +214,67 @@ void FastText::getSubwordVector(Vector& vec, const std::string& subword) const {
   addInputVector(vec, h);
 }
 
-void FastText::saveVectors(const std::string& filename) {
+void FastText::getWordVectors(
+    const std::vector<std::string>& words,
+    DenseMatrix& vectors,
+    int32_t nthreads) const {
+  assert(vectors.size(0) >= static_cast<int64_t>(words.size()));
+  assert(vectors.size(1) == args_->dim);
+  auto compute = [&](int64_t begin, int64_t end) {
+    Vector vec(args_->dim);
+    for (int64_t i = begin; i < end; i++) {
+      getWordVector(vec, words[i]);
+      std::copy(
+          vec.data(), vec.data() + vec.size(), vectors.data() + i * vec.size());
+    }
+  };
+  utils::parallelFor(words.size(), nthreads, compute);
+}
+
+void FastText::saveVectors(
+    const std::string& filename,
+    bool binary,
+    int32_t nthreads) {
+  const int64_t kBlockSize = 16384;
   if (!input_ || !output_) {
     throw std::runtime_error("Model never trained");
   }
-  std::ofstream ofs(filename);
+  std::ofstream ofs(
+      filename, binary ? std::ofstream::binary : std::ofstream::out);
   if (!ofs.is_open()) {
     throw std::invalid_argument(
         filename + " cannot be opened for saving vectors!");
   }
-  ofs << dict_->nwords() << " " << args_->dim << std::endl;
-  Vector vec(args_->dim);
-  for (int32_t i = 0; i < dict_->nwords(); i++) {
-    std::string word = dict_->getWord(i);
-    getWordVector(vec, word);
-    ofs << word << " " << vec << std::endl;
+  const int64_t n = dict_->nwords();
+  const int64_t dim = args_->dim;
+  if (binary) {
+    writeVectorsHeader(ofs, n, dim);
+  } else {
+    ofs << n << " " << dim << std::endl;
+  }
+  // the vectors of a block of words are computed in parallel, then written
+  std::vector<std::string> words;
+  DenseMatrix vectors(std::min(n, kBlockSize), dim);
+  Vector vec(dim);
+  for (int64_t begin = 0; begin < n; begin += kBlockSize) {
+    const int64_t end = std::min(begin + kBlockSize, n);
+    words.clear();
+    for (int64_t i = begin; i < end; i++) {
+      words.push_back(dict_->getWord(i));
+    }
+    getWordVectors(words, vectors, nthreads);
+    if (binary) {
+      ofs.write((char*)vectors.data(), (end - begin) * dim * sizeof(real));
+      continue;
+    }
+    for (int64_t i = 0; i < end - begin; i++) {
+      const real* row = vectors.data() + i * dim;
+      std::copy(row, row + dim, vec.data());
+      ofs << words[i] << " " << vec << "\n";
+    }
+  }
+  if (binary) {
+    writeVectorsWords(ofs, *dict_);
   }
   ofs.close();
 }
@@ -189,7 +344,10 @@ void FastText::saveModel(const std::string& filename) {
   ofs.close();
 }
 
-void FastText::loadModel(const std::string& filename) {
+void FastText::loadModel(
+    const std::string& filename,
+    bool mapped,
+    bool inferenceOnly) {
   std::ifstream ifs(filename, std::ifstream::binary);
   if (!ifs.is_open()) {
     throw std::invalid_argument(filename + " cannot be opened for loading!");
@@ -197,7 +355,11 @@ void FastText::loadModel(const std::string& filename) {
   if (!checkModel(ifs)) {
     throw std::invalid_argument(filename + " has wrong file format!");
   }
-  loadModel(ifs);
+  std::shared_ptr<const MappedFile> file;
+  if (mapped && MappedFile::isSupported()) {
+    file = std::make_shared<MappedFile>(filename);
+  }
+  loadModel(ifs, file, inferenceOnly);
   ifs.close();
 }
 
@@ -210,6 +372,15 @@ std::vector<int64_t> FastText::getTargetCounts() const {
 }
 
 void FastText::loadModel(std::istream& in) {
+  loadModel(in, nullptr, false);
+}
+
+void FastText::loadModel(
+    std::istream& in,
+    std::shared_ptr<const MappedFile> file,
+    bool inferenceOnly) {
+  resetWordVectors();
+  inferenceOnly_ = inferenceOnly;
   args_ = std::make_shared<Args>();
   input_ = std::make_shared<DenseMatrix>();
   output_ = std::make_shared<DenseMatrix>();
@@ -224,7 +395,9 @@ void FastText::loadModel(std::istream& in) {
   in.read((char*)&quant_input, sizeof(bool));
   if (quant_input) {
     quant_ = true;
-    input_ = std::make_shared<QuantMatrix>();
+    input_ = std::make_shared<QuantMatrix>(file);
+  } else if (file) {
+    input_ = std::make_shared<MappedMatrix>(file);
   }
   input_->load(in);
 
@@ -237,7 +410,9 @@ void FastText::loadModel(std::istream& in) {
 
   in.read((char*)&args_->qout, sizeof(bool));
   if (quant_ && args_->qout) {
-    output_ = std::make_shared<QuantMatrix>();
+    output_ = std::make_shared<QuantMatrix>(file);
+  } else if (file) {
+    output_ = std::make_shared<MappedMatrix>(file);
   }
   output_->load(in);
 
@@ -292,6 +467,10 @@ void FastText::quantize(const Args& qargs) {
     throw std::invalid_argument(
         "For now we only support quantization of supervised models");
   }
+  if (inferenceOnly_ && qargs.retrain) {
+    throw std::invalid_argument(
+        "Retraining is not supported for models loaded for inference only");
+  }
   args_->input = qargs.input;
   args_->qout = qargs.qout;
   args_->output = qargs.output;
@@ -299,6 +478,10 @@ void FastText::quantize(const Args& qargs) {
       std::dynamic_pointer_cast<DenseMatrix>(input_);
   std::shared_ptr<DenseMatrix> output =
       std::dynamic_pointer_cast<DenseMatrix>(output_);
+  if (!input || !output) {
+    throw std::invalid_argument(
+        "Quantization is not supported for memory mapped models");
+  }
   bool normalizeGradient = (args_->model == model_name::sup);
 
   if (qargs.cutoff > 0 && qargs.cutoff < input->size(0)) {
@@ -324,14 +507,15 @@ void FastText::quantize(const Args& qargs) {
   }
 
   input_ = std::make_shared<QuantMatrix>(
-      std::move(*(input.get())), qargs.dsub, qargs.qnorm);
+      std::move(*(input.get())), qargs.dsub, qargs.qnorm, qargs.thread);
 
   if (args_->qout) {
     output_ = std::make_shared<QuantMatrix>(
-        std::move(*(output.get())), 2, qargs.qnorm);
+        std::move(*(output.get())), 2, qargs.qnorm, qargs.thread);
   }
 
   quant_ = true;
+  resetWordVectors();
   auto loss = createLoss(output_);
   model_ = std::make_shared<Model>(input_, output_, loss, normalizeGradient);
 }
@@ -357,8 +541,19 @@ void FastText::cbow(
     Model::State& state,
     real lr,
     const std::vector<int32_t>& line) {
-  std::vector<int32_t> bow;
   std::uniform_int_distribution<> uniform(1, args_->ws);
+  if (args_->slidingWindow) {
+    const int32_t length = line.size();
+    state.boundaries.resize(length);
+    state.inputs.resize(length);
+    for (int32_t w = 0; w < length; w++) {
+      state.boundaries[w] = uniform(state.rng);
+      state.inputs[w] = &dict_->getSubwords(line[w]);
+    }
+    model_->updateWindows(state.inputs, line, state.boundaries, lr, state);
+    return;
+  }
+  std::vector<int32_t>& bow = state.bow;
   for (int32_t w = 0; w < line.size(); w++) {
     int32_t boundary = uniform(state.rng);
     bow.clear();
@@ -377,17 +572,108 @@ void FastText::skipgram(
     real lr,
     const std::vector<int32_t>& line) {
   std::uniform_int_distribution<> uniform(1, args_->ws);
-  for (int32_t w = 0; w < line.size(); w++) {
+  std::vector<int32_t>& contexts = state.bow;
+  const int32_t length = line.size();
+  for (int32_t w = 0; w < length; w++) {
     int32_t boundary = uniform(state.rng);
     const std::vector<int32_t>& ngrams = dict_->getSubwords(line[w]);
+    if (args_->batchContexts) {
+      contexts.clear();
+      for (int32_t c = -boundary; c <= boundary; c++) {
+        if (c != 0 && w + c >= 0 && w + c < length) {
+          contexts.push_back(w + c);
+        }
+      }
+      model_->update(ngrams, line, contexts, lr, state);
+      continue;
+    }
     for (int32_t c = -boundary; c <= boundary; c++) {
-      if (c != 0 && w + c >= 0 && w + c < line.size()) {
+      if (c != 0 && w + c >= 0 && w + c < length) {
         model_->update(ngrams, line, w + c, lr, state);
       }
     }
   }
 }
 
+void FastText::test(
+    const std::string& filename,
+    int32_t k,
+    real threshold,
+    Meter& meter,
+    int32_t nthreads) const {
+  const int64_t kBatchSize = 64;
+  std::ifstream ifs(filename);
+  if (!ifs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for testing!");
+  }
+  const int64_t size = utils::size(ifs);
+  ifs.close();
+  nthreads = std::max(1, nthreads);
+
+  std::vector<Meter> meters(nthreads);
+  std::vector<std::exception_ptr> errors(nthreads);
+  // a line belongs to the range of its first character
+  auto testRange = [&](int32_t threadId) {
+    const int64_t begin = threadId * size / nthreads;
+    const int64_t end = (threadId + 1) * size / nthreads;
+    std::ifstream in(filename);
+    int64_t pos = begin;
+    std::string text;
+    if (begin > 0) {
+      utils::seek(in, begin - 1);
+      std::getline(in, text);
+      pos += text.size();
+    }
+    Model::BatchState batch(kBatchSize, args_->dim, dict_->nlabels());
+    std::vector<std::vector<int32_t>> inputs(kBatchSize), labels(kBatchSize);
+    std::vector<Predictions> predictions;
+    std::vector<int32_t> hashes;
+    int64_t n = 0;
+    auto flush = [&]() {
+      inputs.resize(n);
+      predict(k, inputs, predictions, batch, threshold);
+      for (int64_t i = 0; i < n; i++) {
+        meters[threadId].log(labels[i], predictions[i]);
+      }
+      inputs.resize(kBatchSize);
+      n = 0;
+    };
+    while (pos < end && std::getline(in, text)) {
+      pos += text.size() + 1;
+      // the end of line is a token, as in the stream version
+      if (!in.eof()) {
+        text.push_back('\n');
+      }
+      const char* data = text.data();
+      dict_->getLine(data, data + text.size(), inputs[n], labels[n], hashes);
+      if (!labels[n].empty() && !inputs[n].empty() && ++n == kBatchSize) {
+        flush();
+      }
+    }
+    flush();
+  };
+
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < nthreads; i++) {
+    threads.push_back(std::thread([&, i]() {
+      try {
+        testRange(i);
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    }));
+  }
+  for (int32_t i = 0; i < nthreads; i++) {
+    threads[i].join();
+  }
+  for (int32_t i = 0; i < nthreads; i++) {
+    if (errors[i]) {
+      std::rethrow_exception(errors[i]);
+    }
+    meter.merge(meters[i]);
+  }
+}
+
 std::tuple<int64_t, double, double>
 FastText::test(std::istream& in, int32_t k, real threshold) {
   Meter meter;
@@ -428,12 +714,45 @@ void FastText::predict(
     return;
   }
   Model::State state(args_->dim, dict_->nlabels(), 0);
+  predict(k, words, predictions, state, threshold);
+}
+
+void FastText::predict(
+    int32_t k,
+    const std::vector<int32_t>& words,
+    Predictions& predictions,
+    Model::State& state,
+    real threshold) const {
+  if (words.empty()) {
+    return;
+  }
   if (args_->model != model_name::sup) {
     throw std::invalid_argument("Model needs to be supervised for prediction!");
   }
   model_->predict(words, k, threshold, predictions, state);
 }
 
+void FastText::predict(
+    int32_t k,
+    const std::vector<std::vector<int32_t>>& inputs,
+    std::vector<Predictions>& predictions,
+    Model::BatchState& batch,
+    real threshold) const {
+  if (args_->model != model_name::sup) {
+    throw std::invalid_argument("Model needs to be supervised for prediction!");
+  }
+  model_->predict(inputs, k, threshold, predictions, batch);
+}
+
+void FastText::predictProbabilities(
+    const std::vector<std::vector<int32_t>>& inputs,
+    Model::BatchState& batch) const {
+  if (args_->model != model_name::sup) {
+    throw std::invalid_argument("Model needs to be supervised for prediction!");
+  }
+  model_->computeOutput(inputs, batch);
+}
+
 bool FastText::predictLine(
     std::istream& in,
     std::vector<std::pair<real, std::string>>& predictions,
@@ -489,6 +808,56 @@ void FastText::getSentenceVector(std::istream& in, fasttext::Vector& svec) {
   }
 }
 
+void FastText::getSentenceVectors(
+    const std::vector<TextSpan>& texts,
+    DenseMatrix& vectors) const {
+  assert(vectors.rows() >= static_cast<int64_t>(texts.size()));
+  Vector svec(args_->dim);
+  Vector vec(args_->dim);
+  std::vector<int32_t> words, labels, hashes;
+  for (size_t i = 0; i < texts.size(); i++) {
+    const char* begin = texts[i].data;
+    const char* end = begin + texts[i].size;
+    svec.zero();
+    if (args_->model == model_name::sup) {
+      dict_->getLine(begin, end, words, labels, hashes);
+      for (size_t j = 0; j < words.size(); j++) {
+        addInputVector(svec, words[j]);
+      }
+      if (!words.empty()) {
+        svec.mul(1.0 / words.size());
+      }
+    } else {
+      TextSpan token;
+      uint32_t h;
+      int32_t count = 0;
+      // only the end of the first line is EOS, not a "</s>" word
+      while (dict_->readWord(begin, end, token, h) &&
+             token.data != Dictionary::EOS.data()) {
+        dict_->getSubwords(token, h, words);
+        vec.zero();
+        for (size_t j = 0; j < words.size(); j++) {
+          addInputVector(vec, words[j]);
+        }
+        if (words.size() > 0) {
+          vec.mul(1.0 / words.size());
+        }
+        real norm = vec.norm();
+        if (norm > 0) {
+          vec.mul(1.0 / norm);
+          svec.addVector(vec);
+          count++;
+        }
+      }
+      if (count > 0) {
+        svec.mul(1.0 / count);
+      }
+    }
+    std::copy(
+        svec.data(), svec.data() + args_->dim, vectors.data() + i * args_->dim);
+  }
+}
+
 std::vector<std::pair<std::string, Vector>> FastText::getNgramVectors(
     const std::string& word) const {
   std::vector<std::pair<std::string, Vector>> result;
@@ -506,78 +875,218 @@ std::vector<std::pair<std::string, Vector>> FastText::getNgramVectors(
   return result;
 }
 
-void FastText::precomputeWordVectors(DenseMatrix& wordVectors) {
-  Vector vec(args_->dim);
+void FastText::precomputeWordVectors(
+    DenseMatrix& wordVectors,
+    int32_t nthreads) {
   wordVectors.zero();
-  for (int32_t i = 0; i < dict_->nwords(); i++) {
-    std::string word = dict_->getWord(i);
-    getWordVector(vec, word);
-    real norm = vec.norm();
-    if (norm > 0) {
-      wordVectors.addVectorToRow(vec, i, 1.0 / norm);
+  auto compute = [&](int64_t begin, int64_t end) {
+    Vector vec(args_->dim);
+    for (int64_t i = begin; i < end; i++) {
+      std::string word = dict_->getWord(i);
+      getWordVector(vec, word);
+      real norm = vec.norm();
+      if (norm > 0) {
+        wordVectors.addVectorToRow(vec, i, 1.0 / norm);
+      }
     }
-  }
+  };
+  utils::parallelFor(dict_->nwords(), nthreads, compute);
 }
 
-void FastText::lazyComputeWordVectors() {
+void FastText::lazyComputeWordVectors(int32_t nthreads) {
   if (!wordVectors_) {
     wordVectors_ = std::unique_ptr<DenseMatrix>(
         new DenseMatrix(dict_->nwords(), args_->dim));
-    precomputeWordVectors(*wordVectors_);
+    precomputeWordVectors(*wordVectors_, nthreads);
+  }
+}
+
+void FastText::saveNNVectors(const std::string& filename, int32_t nthreads) {
+  std::ofstream ofs(filename, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for saving.");
+  }
+  lazyComputeWordVectors(nthreads);
+  writeVectorsHeader(ofs, wordVectors_->size(0), wordVectors_->size(1));
+  ofs.write(
+      (char*)wordVectors_->data(),
+      wordVectors_->size(0) * wordVectors_->size(1) * sizeof(real));
+  writeVectorsWords(ofs, *dict_);
+  ofs.close();
+}
+
+void FastText::loadNNVectors(const std::string& filename) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for loading!");
+  }
+  int64_t n, dim;
+  if (!readVectorsHeader(ifs, n, dim)) {
+    throw std::invalid_argument(filename + " has wrong file format!");
   }
+  if (n != dict_->nwords() || dim != args_->dim) {
+    throw std::invalid_argument(
+        filename + " was not computed for the words of this model!");
+  }
+  std::unique_ptr<DenseMatrix> wordVectors(new DenseMatrix(n, dim));
+  ifs.read((char*)wordVectors->data(), n * dim * sizeof(real));
+  std::string word;
+  for (int32_t i = 0; i < n; i++) {
+    if (!std::getline(ifs, word, '\0') || word != dict_->getWord(i)) {
+      throw std::invalid_argument(
+          filename + " was not computed for the words of this model!");
+    }
+  }
+  ifs.close();
+  wordVectors_ = std::move(wordVectors);
+}
+
+void FastText::resetWordVectors() {
+  nnIndex_.reset();
+  wordVectors_.reset();
 }
 
 std::vector<std::pair<real, std::string>> FastText::getNN(
     const std::string& word,
-    int32_t k) {
+    int32_t k,
+    int32_t ef) {
   Vector query(args_->dim);
 
   getWordVector(query, word);
 
   lazyComputeWordVectors();
   assert(wordVectors_);
-  return getNN(*wordVectors_, query, k, {word});
+  return getNN(*wordVectors_, query, k, {word}, ef);
+}
+
+std::vector<std::pair<real, std::string>>
+FastText::getNN(const Vector& query, int32_t k, int32_t ef) {
+  if (query.size() != args_->dim) {
+    throw std::invalid_argument(
+        "Query vector dimension must be " + std::to_string(args_->dim));
+  }
+  lazyComputeWordVectors();
+  assert(wordVectors_);
+  return getNN(*wordVectors_, query, k, {}, ef);
 }
 
 std::vector<std::pair<real, std::string>> FastText::getNN(
     const DenseMatrix& wordVectors,
     const Vector& query,
     int32_t k,
-    const std::set<std::string>& banSet) {
-  std::vector<std::pair<real, std::string>> heap;
-
+    const std::set<std::string>& banSet,
+    int32_t ef) {
   real queryNorm = query.norm();
   if (std::abs(queryNorm) < 1e-8) {
     queryNorm = 1;
   }
 
-  for (int32_t i = 0; i < dict_->nwords(); i++) {
-    std::string word = dict_->getWord(i);
-    if (banSet.find(word) == banSet.end()) {
+  std::vector<int32_t> banned;
+  for (const auto& word : banSet) {
+    int32_t id = dict_->getId(word);
+    if (id >= 0) {
+      banned.push_back(id);
+    }
+  }
+  auto isBanned = [&banned](int32_t id) {
+    return std::find(banned.begin(), banned.end(), id) != banned.end();
+  };
+  auto compare = [](const std::pair<real, int32_t>& l,
+                    const std::pair<real, int32_t>& r) {
+    return l.first > r.first;
+  };
+
+  std::vector<std::pair<real, int32_t>> heap;
+  if (nnIndex_) {
+    int32_t n = k + banned.size();
+    nnIndex_->search(wordVectors, query, n, std::max(ef, n), heap);
+    heap.erase(
+        std::remove_if(
+            heap.begin(),
+            heap.end(),
+            [&isBanned](const std::pair<real, int32_t>& p) {
+              return isBanned(p.second);
+            }),
+        heap.end());
+    if (heap.size() > static_cast<size_t>(k)) {
+      heap.resize(k);
+    }
+  } else {
+    for (int32_t i = 0; i < dict_->nwords(); i++) {
+      if (isBanned(i)) {
+        continue;
+      }
       real dp = wordVectors.dotRow(query, i);
-      real similarity = dp / queryNorm;
-
-      if (heap.size() == k && similarity < heap.front().first) {
+      if (heap.size() == static_cast<size_t>(k) && dp < heap.front().first) {
         continue;
       }
-      heap.push_back(std::make_pair(similarity, word));
-      std::push_heap(heap.begin(), heap.end(), comparePairs);
+      heap.push_back(std::make_pair(dp, i));
+      std::push_heap(heap.begin(), heap.end(), compare);
       if (heap.size() > k) {
-        std::pop_heap(heap.begin(), heap.end(), comparePairs);
+        std::pop_heap(heap.begin(), heap.end(), compare);
         heap.pop_back();
       }
     }
+    std::sort_heap(heap.begin(), heap.end(), compare);
+  }
+
+  std::vector<std::pair<real, std::string>> results;
+  results.reserve(heap.size());
+  for (const auto& p : heap) {
+    results.push_back(
+        std::make_pair(p.first / queryNorm, dict_->getWord(p.second)));
+  }
+  return results;
+}
+
+void FastText::buildNNIndex(
+    int32_t M,
+    int32_t efConstruction,
+    int32_t nthreads) {
+  lazyComputeWordVectors(nthreads);
+  std::unique_ptr<HnswIndex> index(new HnswIndex());
+  index->build(*wordVectors_, M, efConstruction, nthreads, args_->seed);
+  nnIndex_ = std::move(index);
+}
+
+void FastText::saveNNIndex(const std::string& filename) const {
+  if (!nnIndex_) {
+    throw std::invalid_argument("No nearest neighbour index to save.");
+  }
+  std::ofstream ofs(filename, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for saving.");
+  }
+  nnIndex_->save(ofs);
+  ofs.close();
+}
+
+void FastText::loadNNIndex(const std::string& filename) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for loading!");
   }
-  std::sort_heap(heap.begin(), heap.end(), comparePairs);
+  std::unique_ptr<HnswIndex> index(new HnswIndex());
+  index->load(ifs);
+  ifs.close();
+  if (index->size() != dict_->nwords() || index->dim() != args_->dim) {
+    throw std::invalid_argument(
+        filename + " was not built for the words of this model!");
+  }
+  lazyComputeWordVectors();
+  nnIndex_ = std::move(index);
+}
 
-  return heap;
+bool FastText::hasNNIndex() const {
+  return bool(nnIndex_);
 }
 
 std::vector<std::pair<real, std::string>> FastText::getAnalogies(
     int32_t k,
     const std::string& wordA,
     const std::string& wordB,
-    const std::string& wordC) {
+    const std::string& wordC,
+    int32_t ef) {
   Vector query = Vector(args_->dim);
   query.zero();
 
@@ -591,7 +1100,7 @@ std::vector<std::pair<real, std::string>> FastText::getAnalogies(
 
   lazyComputeWordVectors();
   assert(wordVectors_);
-  return getNN(*wordVectors_, query, k, {wordA, wordB, wordC});
+  return getNN(*wordVectors_, query, k, {wordA, wordB, wordC}, ef);
 }
 
 bool FastText::keepTraining(const int64_t ntokens) const {
@@ -599,28 +1108,49 @@ bool FastText::keepTraining(const int64_t ntokens) const {
 }
 
 void FastText::trainThread(int32_t threadId) {
-  std::ifstream ifs(args_->input);
-  utils::seek(ifs, threadId * utils::size(ifs) / args_->thread);
+  // documents are read either from the input file or from the in-memory
+  // corpus, each thread starting at a different position
+  std::ifstream ifs;
+  int64_t pos = 0;
+  if (corpus_) {
+    pos = corpus_->lineStart(threadId * corpus_->size() / args_->thread);
+  } else {
+    ifs.open(args_->input);
+    utils::seek(ifs, threadId * utils::size(ifs) / args_->thread);
+  }
 
   Model::State state(args_->dim, output_->size(0), threadId + args_->seed);
+  if (args_->outputSync > 0) {
+    model_->setLocalOutput(state);
+  }
 
   const int64_t ntokens = dict_->ntokens();
   int64_t localTokenCount = 0;
+  int64_t nlines = 0;
   std::vector<int32_t> line, labels;
   try {
     while (keepTraining(ntokens)) {
       real progress = real(tokenCount_) / (args_->epoch * ntokens);
       real lr = args_->lr * (1.0 - progress);
       if (args_->model == model_name::sup) {
-        localTokenCount += dict_->getLine(ifs, line, labels);
+        localTokenCount += corpus_
+            ? dict_->getLine(*corpus_, pos, line, labels)
+            : dict_->getLine(ifs, line, labels);
         supervised(state, lr, line, labels);
       } else if (args_->model == model_name::cbow) {
-        localTokenCount += dict_->getLine(ifs, line, state.rng);
+        localTokenCount += corpus_
+            ? dict_->getLine(*corpus_, pos, line, state.rng)
+            : dict_->getLine(ifs, line, state.rng);
         cbow(state, lr, line);
       } else if (args_->model == model_name::sg) {
-        localTokenCount += dict_->getLine(ifs, line, state.rng);
+        localTokenCount += corpus_
+            ? dict_->getLine(*corpus_, pos, line, state.rng)
+            : dict_->getLine(ifs, line, state.rng);
         skipgram(state, lr, line);
       }
+      if (args_->outputSync > 0 && ++nlines % args_->outputSync == 0) {
+        model_->syncOutput(state);
+      }
       if (localTokenCount > args_->lrUpdateRate) {
         tokenCount_ += localTokenCount;
         localTokenCount = 0;
@@ -629,6 +1159,9 @@ void FastText::trainThread(int32_t threadId) {
         }
       }
     }
+    if (args_->outputSync > 0) {
+      model_->syncOutput(state);
+    }
   } catch (DenseMatrix::EncounteredNaNError&) {
     trainException_ = std::current_exception();
   }
@@ -637,48 +1170,206 @@ void FastText::trainThread(int32_t threadId) {
   ifs.close();
 }
 
-std::shared_ptr<Matrix> FastText::getInputMatrixFromFile(
-    const std::string& filename) const {
-  std::ifstream in(filename);
-  std::vector<std::string> words;
-  std::shared_ptr<DenseMatrix> mat; // temp. matrix for pretrained vectors
-  int64_t n, dim;
-  if (!in.is_open()) {
-    throw std::invalid_argument(filename + " cannot be opened for loading!");
-  }
-  in >> n >> dim;
+void FastText::checkPretrainedDimension(int64_t dim) const {
   if (dim != args_->dim) {
     throw std::invalid_argument(
         "Dimension of pretrained vectors (" + std::to_string(dim) +
         ") does not match dimension (" + std::to_string(args_->dim) + ")!");
   }
-  mat = std::make_shared<DenseMatrix>(n, dim);
-  for (size_t i = 0; i < n; i++) {
-    std::string word;
-    in >> word;
-    words.push_back(word);
-    dict_->add(word);
-    for (size_t j = 0; j < dim; j++) {
-      in >> mat->at(i, j);
-    }
-  }
-  in.close();
+}
 
+std::shared_ptr<DenseMatrix> FastText::createPretrainedInputMatrix(
+    const std::vector<TextSpan>& words,
+    std::vector<int64_t>& rows) const {
+  for (const TextSpan& word : words) {
+    dict_->add(std::string(word.data, word.size));
+  }
   dict_->threshold(1, 0);
   dict_->init();
   std::shared_ptr<DenseMatrix> input = std::make_shared<DenseMatrix>(
       dict_->nwords() + args_->bucket, args_->dim);
   input->uniform(1.0 / args_->dim, args_->thread, args_->seed);
 
-  for (size_t i = 0; i < n; i++) {
-    int32_t idx = dict_->getId(words[i]);
-    if (idx < 0 || idx >= dict_->nwords()) {
+  // the last vector of a word wins
+  std::vector<bool> seen(dict_->nwords(), false);
+  rows.assign(words.size(), -1);
+  for (int64_t i = int64_t(words.size()) - 1; i >= 0; i--) {
+    const TextSpan& word = words[i];
+    int32_t idx = dict_->getId(word, dict_->hash(word.data, word.size));
+    if (idx < 0 || idx >= dict_->nwords() || seen[idx]) {
       continue;
     }
-    for (size_t j = 0; j < dim; j++) {
-      input->at(idx, j) = mat->at(i, j);
+    seen[idx] = true;
+    rows[i] = idx;
+  }
+  return input;
+}
+
+std::shared_ptr<Matrix> FastText::getInputMatrixFromFile(
+    const std::string& filename) const {
+  std::ifstream in(filename, std::ifstream::binary);
+  if (!in.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for loading!");
+  }
+  int32_t magic = 0;
+  in.read((char*)&magic, sizeof(int32_t));
+  in.close();
+  if (magic == FASTTEXT_FILEFORMAT_MAGIC_INT32) {
+    return getInputMatrixFromModel(filename);
+  }
+  if (magic == VECTORS_FILEFORMAT_MAGIC_INT32) {
+    return getInputMatrixFromVectors(filename);
+  }
+  return getInputMatrixFromText(filename);
+}
+
+std::shared_ptr<Matrix> FastText::getInputMatrixFromText(
+    const std::string& filename) const {
+  std::unique_ptr<MappedFile> file;
+  std::string content;
+  const char* data;
+  int64_t size;
+  if (MappedFile::isSupported()) {
+    file.reset(new MappedFile(filename));
+    data = file->data();
+    size = file->size();
+  } else {
+    std::ifstream in(filename, std::ifstream::binary);
+    content.assign(
+        std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    data = content.data();
+    size = content.size();
+  }
+  const char* pos = data;
+  const char* end = data + size;
+
+  const char* eol = static_cast<const char*>(std::memchr(pos, '\n', size));
+  std::istringstream header(std::string(pos, eol ? eol : end));
+  int64_t n, dim;
+  if (!(header >> n >> dim) || n < 0) {
+    throw std::invalid_argument(filename + " has wrong file format!");
+  }
+  checkPretrainedDimension(dim);
+  pos = eol ? eol + 1 : end;
+
+  // one vector per line: its word, then where its values begin
+  std::vector<TextSpan> words;
+  std::vector<const char*> values;
+  words.reserve(std::min(n, size));
+  values.reserve(std::min(n, size));
+  for (int64_t i = 0; i < n; i++) {
+    while (pos < end && (isBlank(*pos) || *pos == '\n')) {
+      pos++;
+    }
+    const char* word = pos;
+    while (pos < end && !isBlank(*pos) && *pos != '\n') {
+      pos++;
+    }
+    if (word == pos) {
+      throw std::invalid_argument(
+          filename + " contains less than " + std::to_string(n) +
+          " vectors!");
     }
+    words.push_back(TextSpan{word, size_t(pos - word)});
+    values.push_back(pos);
+    eol = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+    pos = eol ? eol + 1 : end;
   }
+
+  std::vector<int64_t> rows;
+  std::shared_ptr<DenseMatrix> input =
+      createPretrainedInputMatrix(words, rows);
+  utils::parallelFor(n, args_->thread, [&](int64_t begin, int64_t stop) {
+    for (int64_t i = begin; i < stop; i++) {
+      if (rows[i] < 0) {
+        continue;
+      }
+      const char* value = values[i];
+      real* row = input->data() + rows[i] * dim;
+      for (int64_t j = 0; j < dim; j++) {
+        if (!parseReal(value, end, row[j])) {
+          throw std::invalid_argument(
+              filename + " has an invalid vector for word " +
+              std::string(words[i].data, words[i].size) + "!");
+        }
+      }
+    }
+  });
+  return input;
+}
+
+std::shared_ptr<Matrix> FastText::getInputMatrixFromVectors(
+    const std::string& filename) const {
+  std::ifstream in(filename, std::ifstream::binary);
+  if (!in.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for loading!");
+  }
+  int64_t n, dim;
+  if (!readVectorsHeader(in, n, dim)) {
+    throw std::invalid_argument(filename + " has wrong file format!");
+  }
+  checkPretrainedDimension(dim);
+
+  const int64_t rowSize = dim * sizeof(real);
+  const int64_t matrixBegin = in.tellg();
+  utils::seek(in, matrixBegin + n * rowSize);
+  std::vector<std::string> names(n);
+  std::vector<TextSpan> words(n);
+  for (int64_t i = 0; i < n; i++) {
+    if (!std::getline(in, names[i], '\0')) {
+      throw std::invalid_argument(
+          filename + " contains less than " + std::to_string(n) +
+          " words!");
+    }
+    words[i] = TextSpan{names[i].data(), names[i].size()};
+  }
+
+  std::vector<int64_t> rows;
+  std::shared_ptr<DenseMatrix> input =
+      createPretrainedInputMatrix(words, rows);
+  utils::seek(in, matrixBegin);
+  for (int64_t i = 0; i < n; i++) {
+    if (rows[i] < 0) {
+      in.ignore(rowSize);
+    } else {
+      in.read((char*)(input->data() + rows[i] * dim), rowSize);
+    }
+  }
+  if (!in) {
+    throw std::invalid_argument(filename + " has wrong file format!");
+  }
+  return input;
+}
+
+std::shared_ptr<Matrix> FastText::getInputMatrixFromModel(
+    const std::string& filename) const {
+  FastText pretrained;
+  pretrained.loadModel(filename, false, true);
+  const int64_t dim = pretrained.getArgs().dim;
+  checkPretrainedDimension(dim);
+  std::shared_ptr<const Dictionary> dict = pretrained.getDictionary();
+  const int32_t n = dict->nwords();
+  std::vector<std::string> names(n);
+  std::vector<TextSpan> words(n);
+  for (int32_t i = 0; i < n; i++) {
+    names[i] = dict->getWord(i);
+    words[i] = TextSpan{names[i].data(), names[i].size()};
+  }
+
+  std::vector<int64_t> rows;
+  std::shared_ptr<DenseMatrix> input =
+      createPretrainedInputMatrix(words, rows);
+  utils::parallelFor(n, args_->thread, [&](int64_t begin, int64_t end) {
+    Vector vec(dim);
+    for (int64_t i = begin; i < end; i++) {
+      if (rows[i] < 0) {
+        continue;
+      }
+      pretrained.getWordVector(vec, names[i]);
+      std::copy(
+          vec.data(), vec.data() + vec.size(), input->data() + rows[i] * dim);
+    }
+  });
   return input;
 }
 
@@ -700,21 +1391,48 @@ std::shared_ptr<Matrix> FastText::createTrainOutputMatrix() const {
   return output;
 }
 
-void FastText::train(const Args& args) {
+void FastText::train(const Args& args, const TrainCallback& callback) {
   args_ = std::make_shared<Args>(args);
   dict_ = std::make_shared<Dictionary>(args_);
   if (args_->input == "-") {
     // manage expectations
     throw std::invalid_argument("Cannot use stdin for training!");
   }
-  std::ifstream ifs(args_->input);
-  if (!ifs.is_open()) {
-    throw std::invalid_argument(
-        args_->input + " cannot be opened for training!");
+  if (args_->thread > 1) {
+    dict_->readFromFile(args_->input, args_->thread);
+  } else {
+    std::ifstream ifs(args_->input);
+    if (!ifs.is_open()) {
+      throw std::invalid_argument(
+          args_->input + " cannot be opened for training!");
+    }
+    dict_->readFromFile(ifs);
+    ifs.close();
   }
-  dict_->readFromFile(ifs);
-  ifs.close();
+  trainFromDictionary(callback);
+}
 
+void FastText::train(const Args& args, const DocumentSource& source) {
+  args_ = std::make_shared<Args>(args);
+  dict_ = std::make_shared<Dictionary>(args_);
+  dict_->readFromSource(source);
+  corpus_ = std::make_shared<Corpus>(source, *dict_, *args_);
+  try {
+    trainFromDictionary();
+  } catch (...) {
+    corpus_.reset();
+    throw;
+  }
+  corpus_.reset();
+}
+
+void FastText::trainFromDictionary(const TrainCallback& callback) {
+  if (args_->outputSync > 0 && args_->model != model_name::sup) {
+    // each thread would keep two copies of the output matrix of the words
+    throw std::invalid_argument(
+        "-outputSync is only supported for supervised models");
+  }
+  resetWordVectors();
   if (!args_->pretrainedVectors.empty()) {
     input_ = getInputMatrixFromFile(args_->pretrainedVectors);
   } else {
@@ -722,10 +1440,11 @@ void FastText::train(const Args& args) {
   }
   output_ = createTrainOutputMatrix();
   quant_ = false;
+  inferenceOnly_ = false;
   auto loss = createLoss(output_);
   bool normalizeGradient = (args_->model == model_name::sup);
   model_ = std::make_shared<Model>(input_, output_, loss, normalizeGradient);
-  startThreads();
+  startThreads(callback);
 }
 
 void FastText::abort() {
@@ -736,7 +1455,7 @@ void FastText::abort() {
   }
 }
 
-void FastText::startThreads() {
+void FastText::startThreads(const TrainCallback& callback) {
   start_ = std::chrono::steady_clock::now();
   tokenCount_ = 0;
   loss_ = -1;
@@ -749,11 +1468,18 @@ void FastText::startThreads() {
   // Same condition as trainThread
   while (keepTraining(ntokens)) {
     std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    real progress = real(tokenCount_) / (args_->epoch * ntokens);
     if (loss_ >= 0 && args_->verbose > 1) {
-      real progress = real(tokenCount_) / (args_->epoch * ntokens);
       std::cerr << "\r";
       printInfo(progress, loss_, std::cerr);
     }
+    if (callback) {
+      try {
+        callback(progress);
+      } catch (...) {
+        trainException_ = std::current_exception();
+      }
+    }
   }
   for (int32_t i = 0; i < args_->thread; i++) {
     threads[i].join();
@@ -778,6 +1504,10 @@ bool FastText::isQuant() const {
   return quant_;
 }
 
+bool FastText::isInferenceOnly() const {
+  return inferenceOnly_;
+}
+
 bool comparePairs(
     const std::pair<real, std::string>& l,
     const std::pair<real, std::string>& r) {
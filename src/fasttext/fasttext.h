@@ -12,6 +12,7 @@
 
 #include <atomic>
 #include <chrono>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <queue>
@@ -19,8 +20,11 @@
 #include <tuple>
 
 #include "args.h"
+#include "corpus.h"
 #include "densematrix.h"
 #include "dictionary.h"
+#include "hnsw.h"
+#include "mappedfile.h"
 #include "matrix.h"
 #include "meter.h"
 #include "model.h"
@@ -31,37 +35,66 @@
 namespace fasttext {
 
 class FastText {
+ public:
+  // called about every 100ms during a training by the thread waiting for the
+  // training threads, with the progress of the training (from 0 to 1); it can
+  // stop the training with abort() or by throwing an exception
+  using TrainCallback = std::function<void(real)>;
+
  protected:
   std::shared_ptr<Args> args_;
   std::shared_ptr<Dictionary> dict_;
   std::shared_ptr<Matrix> input_;
   std::shared_ptr<Matrix> output_;
   std::shared_ptr<Model> model_;
+  std::shared_ptr<const Corpus> corpus_;
   std::atomic<int64_t> tokenCount_{};
   std::atomic<real> loss_{};
   std::chrono::steady_clock::time_point start_;
   bool quant_;
+  // set by loadModel: the loss has none of the structures of the training
+  bool inferenceOnly_;
   int32_t version;
   std::unique_ptr<DenseMatrix> wordVectors_;
+  std::unique_ptr<HnswIndex> nnIndex_;
   std::exception_ptr trainException_;
 
   void signModel(std::ostream&);
   bool checkModel(std::istream&);
-  void startThreads();
+  void startThreads(const TrainCallback& callback = nullptr);
+  void trainFromDictionary(const TrainCallback& callback = nullptr);
   void addInputVector(Vector&, int32_t) const;
   void trainThread(int32_t);
   std::vector<std::pair<real, std::string>> getNN(
       const DenseMatrix& wordVectors,
       const Vector& queryVec,
       int32_t k,
-      const std::set<std::string>& banSet);
-  void lazyComputeWordVectors();
+      const std::set<std::string>& banSet,
+      int32_t ef);
+  void lazyComputeWordVectors(int32_t nthreads = 1);
+  void resetWordVectors();
   void printInfo(real, real, std::ostream&);
+  // Pretrained vectors are read from a text .vec file, a binary vectors file
+  // or the words of a model, straight into the rows of the input matrix.
   std::shared_ptr<Matrix> getInputMatrixFromFile(const std::string&) const;
+  std::shared_ptr<Matrix> getInputMatrixFromText(const std::string&) const;
+  std::shared_ptr<Matrix> getInputMatrixFromVectors(const std::string&) const;
+  std::shared_ptr<Matrix> getInputMatrixFromModel(const std::string&) const;
+  void checkPretrainedDimension(int64_t dim) const;
+  // adds the pretrained words to the dictionary, rows[i] being the row of
+  // the input matrix of words[i] or -1 if it is not a word or if there is a
+  // later vector for it
+  std::shared_ptr<DenseMatrix> createPretrainedInputMatrix(
+      const std::vector<TextSpan>& words,
+      std::vector<int64_t>& rows) const;
   std::shared_ptr<Matrix> createRandomMatrix() const;
   std::shared_ptr<Matrix> createTrainOutputMatrix() const;
   std::vector<int64_t> getTargetCounts() const;
   std::shared_ptr<Loss> createLoss(std::shared_ptr<Matrix>& output);
+  void loadModel(
+      std::istream& in,
+      std::shared_ptr<const MappedFile> file,
+      bool inferenceOnly);
   void supervised(
       Model::State& state,
       real lr,
@@ -70,10 +103,12 @@ class FastText {
   void cbow(Model::State& state, real lr, const std::vector<int32_t>& line);
   void skipgram(Model::State& state, real lr, const std::vector<int32_t>& line);
   std::vector<int32_t> selectEmbeddings(int32_t cutoff) const;
-  void precomputeWordVectors(DenseMatrix& wordVectors);
+  void precomputeWordVectors(DenseMatrix& wordVectors, int32_t nthreads);
   bool keepTraining(const int64_t ntokens) const;
 
  public:
+  static const int32_t kDefaultEf = 100;
+
   FastText();
 
   int32_t getWordId(const std::string& word) const;
@@ -97,7 +132,20 @@ class FastText {
 
   std::shared_ptr<const DenseMatrix> getOutputMatrix() const;
 
-  void saveVectors(const std::string& filename);
+  // row i of vectors gets the vector of words[i], computed by nthreads
+  // threads
+  void getWordVectors(
+      const std::vector<std::string>& words,
+      DenseMatrix& vectors,
+      int32_t nthreads = 1) const;
+
+  // Saves the vectors of the words of the dictionary, as text or in the
+  // binary format read by -pretrainedVectors. They are computed by blocks of
+  // words, each one by nthreads threads.
+  void saveVectors(
+      const std::string& filename,
+      bool binary = false,
+      int32_t nthreads = 1);
 
   void saveModel(const std::string& filename);
 
@@ -105,16 +153,38 @@ class FastText {
 
   void loadModel(std::istream& in);
 
-  void loadModel(const std::string& filename);
+  // A model loaded for inference only can predict and give vectors, but not
+  // be trained (nor retrained by quantize): the negatives of -loss ns and the
+  // paths of -loss hs are not built.
+  void loadModel(
+      const std::string& filename,
+      bool mapped = false,
+      bool inferenceOnly = false);
 
   void getSentenceVector(std::istream& in, Vector& vec);
 
+  // row i of vectors gets the sentence vector of texts[i] (of its first
+  // line, as getSentenceVector), the texts being tokenized in place
+  void getSentenceVectors(
+      const std::vector<TextSpan>& texts,
+      DenseMatrix& vectors) const;
+
   void quantize(const Args& qargs);
 
   std::tuple<int64_t, double, double>
   test(std::istream& in, int32_t k, real threshold = 0.0);
 
   void test(std::istream& in, int32_t k, real threshold, Meter& meter) const;
+  // Same as test on the file, split in nthreads ranges of lines which are
+  // scored in parallel, by batches, each with its own meter. The meters are
+  // merged in the order of the ranges: the result does not depend on
+  // nthreads.
+  void test(
+      const std::string& filename,
+      int32_t k,
+      real threshold,
+      Meter& meter,
+      int32_t nthreads) const;
 
   void predict(
       int32_t k,
@@ -122,6 +192,27 @@ class FastText {
       Predictions& predictions,
       real threshold = 0.0) const;
 
+  void predict(
+      int32_t k,
+      const std::vector<int32_t>& words,
+      Predictions& predictions,
+      Model::State& state,
+      real threshold = 0.0) const;
+
+  // Batched predictions: the inputs (at most batch.size()) are scored
+  // together, by a single product with the output matrix.
+  void predict(
+      int32_t k,
+      const std::vector<std::vector<int32_t>>& inputs,
+      std::vector<Predictions>& predictions,
+      Model::BatchState& batch,
+      real threshold = 0.0) const;
+
+  // row i of batch.output gets the probability of each label for inputs[i]
+  void predictProbabilities(
+      const std::vector<std::vector<int32_t>>& inputs,
+      Model::BatchState& batch) const;
+
   bool predictLine(
       std::istream& in,
       std::vector<std::pair<real, std::string>>& predictions,
@@ -131,17 +222,44 @@ class FastText {
   std::vector<std::pair<std::string, Vector>> getNgramVectors(
       const std::string& word) const;
 
+  // ef is only used when a nearest neighbour index has been built or loaded,
+  // otherwise the search is exhaustive.
   std::vector<std::pair<real, std::string>> getNN(
       const std::string& word,
-      int32_t k);
+      int32_t k,
+      int32_t ef = kDefaultEf);
+
+  std::vector<std::pair<real, std::string>> getNN(
+      const Vector& query,
+      int32_t k,
+      int32_t ef = kDefaultEf);
 
   std::vector<std::pair<real, std::string>> getAnalogies(
       int32_t k,
       const std::string& wordA,
       const std::string& wordB,
-      const std::string& wordC);
+      const std::string& wordC,
+      int32_t ef = kDefaultEf);
+
+  void buildNNIndex(int32_t M, int32_t efConstruction, int32_t nthreads);
 
-  void train(const Args& args);
+  void saveNNIndex(const std::string& filename) const;
+
+  void loadNNIndex(const std::string& filename);
+
+  bool hasNNIndex() const;
+
+  // The normalized vectors of the words searched by getNN and indexed by
+  // buildNNIndex are computed on first use. Saving them (computed by
+  // nthreads threads if needed) in the binary vectors format lets other
+  // processes load them instead.
+  void saveNNVectors(const std::string& filename, int32_t nthreads = 1);
+
+  void loadNNVectors(const std::string& filename);
+
+  void train(const Args& args, const TrainCallback& callback = nullptr);
+
+  void train(const Args& args, const DocumentSource& source);
 
   void abort();
 
@@ -149,6 +267,8 @@ class FastText {
 
   bool isQuant() const;
 
+  bool isInferenceOnly() const;
+
   class AbortError : public std::runtime_error {
    public:
     AbortError() : std::runtime_error("Aborted.") {}
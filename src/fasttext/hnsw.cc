@@ -0,0 +1,463 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "hnsw.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+
+#include "kernels.h"
+
+namespace fasttext {
+
+namespace {
+
+constexpr int32_t HNSW_FILEFORMAT_MAGIC_INT32 = 1213090647;
+constexpr int32_t HNSW_VERSION = 1;
+
+typedef std::pair<real, int32_t> Candidate;
+
+} // namespace
+
+// Nodes already reached by a search. Builds use one tag per node so that the
+// set is cleared in constant time between insertions; single queries use a
+// hash set to avoid allocating one entry per node.
+class HnswIndex::VisitedSet {
+ public:
+  VisitedSet() : tag_(0) {}
+  explicit VisitedSet(int64_t n) : tags_(n, 0), tag_(0) {}
+
+  void clear() {
+    if (tags_.empty()) {
+      set_.clear();
+    } else if (++tag_ == 0) {
+      std::fill(tags_.begin(), tags_.end(), 0);
+      tag_ = 1;
+    }
+  }
+
+  bool insert(int32_t i) {
+    if (tags_.empty()) {
+      return set_.insert(i).second;
+    }
+    if (tags_[i] == tag_) {
+      return false;
+    }
+    tags_[i] = tag_;
+    return true;
+  }
+
+ private:
+  std::vector<uint32_t> tags_;
+  uint32_t tag_;
+  std::unordered_set<int32_t> set_;
+};
+
+struct HnswIndex::BuildState {
+  explicit BuildState(int64_t n) : locks(n) {}
+  std::vector<std::mutex> locks;
+  std::mutex global;
+};
+
+HnswIndex::HnswIndex()
+    : M_(kDefaultM),
+      maxM0_(2 * kDefaultM),
+      efConstruction_(kDefaultEfConstruction),
+      n_(0),
+      dim_(0),
+      maxLevel_(-1),
+      entryPoint_(-1) {}
+
+int32_t* HnswIndex::links(int32_t node, int32_t level) {
+  if (level == 0) {
+    return links0_.data() + int64_t(node) * (maxM0_ + 1);
+  }
+  return upperLinks_[node].data() + (level - 1) * (M_ + 1);
+}
+
+const int32_t* HnswIndex::links(int32_t node, int32_t level) const {
+  if (level == 0) {
+    return links0_.data() + int64_t(node) * (maxM0_ + 1);
+  }
+  return upperLinks_[node].data() + (level - 1) * (M_ + 1);
+}
+
+int32_t HnswIndex::maxLinks(int32_t level) const {
+  return level == 0 ? maxM0_ : M_;
+}
+
+real HnswIndex::similarity(
+    const DenseMatrix& vectors,
+    int32_t node,
+    const real* query) const {
+  return kernels::dot(vectors.data() + node * dim_, query, dim_);
+}
+
+void HnswIndex::getLinks(
+    int32_t node,
+    int32_t level,
+    std::vector<int32_t>& result,
+    BuildState* state) const {
+  // during a parallel build, links may be rewritten by another thread
+  std::unique_lock<std::mutex> lock;
+  if (state) {
+    lock = std::unique_lock<std::mutex>(state->locks[node]);
+  }
+  const int32_t* l = links(node, level);
+  result.assign(l + 1, l + 1 + l[0]);
+}
+
+int32_t HnswIndex::searchGreedy(
+    const DenseMatrix& vectors,
+    const real* query,
+    int32_t entry,
+    int32_t fromLevel,
+    int32_t toLevel,
+    BuildState* state) const {
+  std::vector<int32_t> neighbors;
+  real best = similarity(vectors, entry, query);
+  for (int32_t level = fromLevel; level >= toLevel; level--) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      getLinks(entry, level, neighbors, state);
+      for (int32_t neighbor : neighbors) {
+        real s = similarity(vectors, neighbor, query);
+        if (s > best) {
+          best = s;
+          entry = neighbor;
+          changed = true;
+        }
+      }
+    }
+  }
+  return entry;
+}
+
+void HnswIndex::searchLayer(
+    const DenseMatrix& vectors,
+    const real* query,
+    int32_t entry,
+    int32_t ef,
+    int32_t level,
+    std::vector<Candidate>& results,
+    VisitedSet& visited,
+    BuildState* state) const {
+  // candidates to expand, best first, and current best results, worst first
+  std::priority_queue<Candidate> candidates;
+  std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>>
+      best;
+  std::vector<int32_t> neighbors;
+
+  visited.clear();
+  visited.insert(entry);
+  real s = similarity(vectors, entry, query);
+  candidates.push(std::make_pair(s, entry));
+  best.push(std::make_pair(s, entry));
+  while (!candidates.empty()) {
+    Candidate c = candidates.top();
+    if (c.first < best.top().first && best.size() >= static_cast<size_t>(ef)) {
+      break;
+    }
+    candidates.pop();
+    getLinks(c.second, level, neighbors, state);
+    for (int32_t neighbor : neighbors) {
+      if (!visited.insert(neighbor)) {
+        continue;
+      }
+      s = similarity(vectors, neighbor, query);
+      if (best.size() < static_cast<size_t>(ef) || s > best.top().first) {
+        candidates.push(std::make_pair(s, neighbor));
+        best.push(std::make_pair(s, neighbor));
+        if (best.size() > static_cast<size_t>(ef)) {
+          best.pop();
+        }
+      }
+    }
+  }
+  results.resize(best.size());
+  for (int64_t i = results.size() - 1; i >= 0; i--) {
+    results[i] = best.top();
+    best.pop();
+  }
+}
+
+void HnswIndex::selectNeighbors(
+    const DenseMatrix& vectors,
+    std::vector<Candidate>& candidates,
+    int32_t m) const {
+  // keeps a candidate only if it is closer to the base node than to every
+  // neighbor already selected, which spreads links in all directions
+  if (candidates.size() <= static_cast<size_t>(m)) {
+    return;
+  }
+  std::vector<Candidate> selected;
+  for (const Candidate& c : candidates) {
+    if (selected.size() >= static_cast<size_t>(m)) {
+      break;
+    }
+    const real* v = vectors.data() + c.second * dim_;
+    bool keep = true;
+    for (const Candidate& r : selected) {
+      if (similarity(vectors, r.second, v) > c.first) {
+        keep = false;
+        break;
+      }
+    }
+    if (keep) {
+      selected.push_back(c);
+    }
+  }
+  candidates.swap(selected);
+}
+
+void HnswIndex::connect(
+    const DenseMatrix& vectors,
+    int32_t node,
+    int32_t neighbor,
+    int32_t level,
+    BuildState& state) {
+  std::lock_guard<std::mutex> lock(state.locks[neighbor]);
+  int32_t* l = links(neighbor, level);
+  const int32_t m = maxLinks(level);
+  if (l[0] < m) {
+    l[++l[0]] = node;
+    return;
+  }
+  const real* v = vectors.data() + neighbor * dim_;
+  std::vector<Candidate> candidates;
+  candidates.push_back(std::make_pair(similarity(vectors, node, v), node));
+  for (int32_t i = 1; i <= l[0]; i++) {
+    candidates.push_back(std::make_pair(similarity(vectors, l[i], v), l[i]));
+  }
+  std::sort(candidates.begin(), candidates.end(), std::greater<Candidate>());
+  selectNeighbors(vectors, candidates, m);
+  l[0] = candidates.size();
+  for (size_t i = 0; i < candidates.size(); i++) {
+    l[i + 1] = candidates[i].second;
+  }
+}
+
+void HnswIndex::insert(
+    const DenseMatrix& vectors,
+    int32_t node,
+    VisitedSet& visited,
+    BuildState& state) {
+  const real* query = vectors.data() + node * dim_;
+  const int32_t level = levels_[node];
+
+  // the global lock is kept while inserting a node above the current top
+  std::unique_lock<std::mutex> global(state.global);
+  const int32_t maxLevel = maxLevel_;
+  int32_t entry = entryPoint_;
+  if (entry < 0) {
+    entryPoint_ = node;
+    maxLevel_ = level;
+    return;
+  }
+  if (level <= maxLevel) {
+    global.unlock();
+  }
+
+  entry = searchGreedy(vectors, query, entry, maxLevel, level + 1, &state);
+  std::vector<Candidate> candidates;
+  for (int32_t l = std::min(level, maxLevel); l >= 0; l--) {
+    searchLayer(
+        vectors, query, entry, efConstruction_, l, candidates, visited, &state);
+    entry = candidates[0].second;
+    selectNeighbors(vectors, candidates, M_);
+    {
+      std::lock_guard<std::mutex> lock(state.locks[node]);
+      int32_t* nodeLinks = links(node, l);
+      nodeLinks[0] = candidates.size();
+      for (size_t i = 0; i < candidates.size(); i++) {
+        nodeLinks[i + 1] = candidates[i].second;
+      }
+    }
+    for (const Candidate& c : candidates) {
+      connect(vectors, node, c.second, l, state);
+    }
+  }
+  if (level > maxLevel) {
+    entryPoint_ = node;
+    maxLevel_ = level;
+  }
+}
+
+void HnswIndex::build(
+    const DenseMatrix& vectors,
+    int32_t M,
+    int32_t efConstruction,
+    int32_t nthreads,
+    int32_t seed) {
+  if (M < 2 || efConstruction < 1 || nthreads < 1) {
+    throw std::invalid_argument(
+        "M should be 2 or higher, efConstruction and threads 1 or higher.");
+  }
+  M_ = M;
+  maxM0_ = 2 * M;
+  efConstruction_ = std::max(efConstruction, M);
+  n_ = vectors.size(0);
+  dim_ = vectors.size(1);
+  maxLevel_ = -1;
+  entryPoint_ = -1;
+
+  // levels follow a geometric distribution, drawn upfront so that they do
+  // not depend on the number of threads
+  std::minstd_rand rng(seed);
+  std::uniform_real_distribution<> uniform(0, 1);
+  const double mult = 1.0 / std::log(double(M_));
+  levels_.resize(n_);
+  upperLinks_.assign(n_, std::vector<int32_t>());
+  for (int64_t i = 0; i < n_; i++) {
+    levels_[i] = int32_t(-std::log(1.0 - uniform(rng)) * mult);
+    if (levels_[i] > 0) {
+      upperLinks_[i].assign(levels_[i] * (M_ + 1), 0);
+    }
+  }
+  links0_.assign(n_ * (maxM0_ + 1), 0);
+
+  BuildState state(n_);
+  std::atomic<int64_t> next(0);
+  auto work = [&]() {
+    VisitedSet visited(n_);
+    int64_t node;
+    while ((node = next++) < n_) {
+      insert(vectors, node, visited, state);
+    }
+  };
+  if (n_ > 0) {
+    VisitedSet visited(n_);
+    insert(vectors, next++, visited, state);
+  }
+  std::vector<std::thread> threads;
+  for (int32_t i = 1; i < nthreads; i++) {
+    threads.push_back(std::thread(work));
+  }
+  work();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+void HnswIndex::search(
+    const DenseMatrix& vectors,
+    const Vector& query,
+    int32_t k,
+    int32_t ef,
+    std::vector<Candidate>& results) const {
+  if (vectors.size(0) != n_ || vectors.size(1) != dim_ ||
+      query.size() != dim_) {
+    throw std::invalid_argument("Index does not match the vectors.");
+  }
+  results.clear();
+  if (n_ == 0 || k <= 0) {
+    return;
+  }
+  VisitedSet visited;
+  int32_t entry =
+      searchGreedy(vectors, query.data(), entryPoint_, maxLevel_, 1, nullptr);
+  searchLayer(
+      vectors,
+      query.data(),
+      entry,
+      std::max(ef, k),
+      0,
+      results,
+      visited,
+      nullptr);
+  if (results.size() > static_cast<size_t>(k)) {
+    results.resize(k);
+  }
+}
+
+void HnswIndex::save(std::ostream& out) const {
+  const int32_t magic = HNSW_FILEFORMAT_MAGIC_INT32;
+  const int32_t version = HNSW_VERSION;
+  out.write((char*)&(magic), sizeof(int32_t));
+  out.write((char*)&(version), sizeof(int32_t));
+  out.write((char*)&M_, sizeof(int32_t));
+  out.write((char*)&efConstruction_, sizeof(int32_t));
+  out.write((char*)&n_, sizeof(int64_t));
+  out.write((char*)&dim_, sizeof(int64_t));
+  out.write((char*)&maxLevel_, sizeof(int32_t));
+  out.write((char*)&entryPoint_, sizeof(int32_t));
+  out.write((char*)levels_.data(), n_ * sizeof(int32_t));
+  out.write((char*)links0_.data(), links0_.size() * sizeof(int32_t));
+  for (int64_t i = 0; i < n_; i++) {
+    out.write(
+        (char*)upperLinks_[i].data(), upperLinks_[i].size() * sizeof(int32_t));
+  }
+}
+
+void HnswIndex::load(std::istream& in) {
+  int32_t magic, version;
+  in.read((char*)&(magic), sizeof(int32_t));
+  in.read((char*)&(version), sizeof(int32_t));
+  if (!in || magic != HNSW_FILEFORMAT_MAGIC_INT32) {
+    throw std::invalid_argument("Not a nearest neighbour index file.");
+  }
+  if (version > HNSW_VERSION) {
+    throw std::invalid_argument(
+        "Nearest neighbour index file has a newer version.");
+  }
+  in.read((char*)&M_, sizeof(int32_t));
+  in.read((char*)&efConstruction_, sizeof(int32_t));
+  in.read((char*)&n_, sizeof(int64_t));
+  in.read((char*)&dim_, sizeof(int64_t));
+  in.read((char*)&maxLevel_, sizeof(int32_t));
+  in.read((char*)&entryPoint_, sizeof(int32_t));
+  if (!in || M_ < 2 || n_ < 0 || dim_ < 0 || entryPoint_ >= n_) {
+    throw std::invalid_argument("Nearest neighbour index file is corrupted.");
+  }
+  maxM0_ = 2 * M_;
+  levels_.resize(n_);
+  in.read((char*)levels_.data(), n_ * sizeof(int32_t));
+  links0_.resize(n_ * (maxM0_ + 1));
+  in.read((char*)links0_.data(), links0_.size() * sizeof(int32_t));
+  upperLinks_.assign(n_, std::vector<int32_t>());
+  for (int64_t i = 0; i < n_ && in; i++) {
+    if (levels_[i] < 0 || levels_[i] > maxLevel_) {
+      throw std::invalid_argument("Nearest neighbour index file is corrupted.");
+    }
+    upperLinks_[i].resize(levels_[i] * (M_ + 1));
+    in.read(
+        (char*)upperLinks_[i].data(), upperLinks_[i].size() * sizeof(int32_t));
+  }
+  if (!in) {
+    throw std::invalid_argument("Nearest neighbour index file is truncated.");
+  }
+  // searches start at the entry point, on the top level
+  if (n_ == 0 ? entryPoint_ != -1
+              : entryPoint_ < 0 || levels_[entryPoint_] != maxLevel_) {
+    throw std::invalid_argument("Nearest neighbour index file is corrupted.");
+  }
+  for (int64_t i = 0; i < n_; i++) {
+    for (int32_t level = 0; level <= levels_[i]; level++) {
+      const int32_t* l = links(i, level);
+      bool valid = l[0] >= 0 && l[0] <= maxLinks(level);
+      for (int32_t j = 1; valid && j <= l[0]; j++) {
+        valid = l[j] >= 0 && l[j] < n_;
+      }
+      if (!valid) {
+        throw std::invalid_argument(
+            "Nearest neighbour index file is corrupted.");
+      }
+    }
+  }
+}
+
+} // namespace fasttext
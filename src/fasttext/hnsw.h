@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "densematrix.h"
+#include "real.h"
+#include "vector.h"
+
+namespace fasttext {
+
+// Hierarchical navigable small world graph (Malkov & Yashunin, 2016) for
+// approximate maximum inner product search over the rows of a matrix.
+// The index only stores the graph: the matrix it was built on must be given
+// again to search it.
+class HnswIndex {
+ protected:
+  int32_t M_;
+  int32_t maxM0_;
+  int32_t efConstruction_;
+  int64_t n_;
+  int64_t dim_;
+  int32_t maxLevel_;
+  int32_t entryPoint_;
+  std::vector<int32_t> levels_;
+  // links of level 0, for each node: count followed by maxM0_ ids
+  std::vector<int32_t> links0_;
+  // links of levels 1..levels_[i] of node i, each: count followed by M_ ids
+  std::vector<std::vector<int32_t>> upperLinks_;
+
+  struct BuildState;
+  class VisitedSet;
+
+  int32_t* links(int32_t node, int32_t level);
+  const int32_t* links(int32_t node, int32_t level) const;
+  int32_t maxLinks(int32_t level) const;
+  real similarity(const DenseMatrix&, int32_t, const real*) const;
+  void getLinks(int32_t, int32_t, std::vector<int32_t>&, BuildState*) const;
+  int32_t searchGreedy(
+      const DenseMatrix&,
+      const real*,
+      int32_t entry,
+      int32_t fromLevel,
+      int32_t toLevel,
+      BuildState*) const;
+  void searchLayer(
+      const DenseMatrix&,
+      const real*,
+      int32_t entry,
+      int32_t ef,
+      int32_t level,
+      std::vector<std::pair<real, int32_t>>& results,
+      VisitedSet&,
+      BuildState*) const;
+  void selectNeighbors(
+      const DenseMatrix&,
+      std::vector<std::pair<real, int32_t>>& candidates,
+      int32_t m) const;
+  void connect(
+      const DenseMatrix&,
+      int32_t node,
+      int32_t neighbor,
+      int32_t level,
+      BuildState&);
+  void insert(const DenseMatrix&, int32_t node, VisitedSet&, BuildState&);
+
+ public:
+  static const int32_t kDefaultM = 16;
+  static const int32_t kDefaultEfConstruction = 100;
+
+  HnswIndex();
+  HnswIndex(const HnswIndex&) = delete;
+  HnswIndex& operator=(const HnswIndex&) = delete;
+
+  inline int64_t size() const {
+    return n_;
+  }
+  inline int64_t dim() const {
+    return dim_;
+  }
+
+  void build(
+      const DenseMatrix& vectors,
+      int32_t M,
+      int32_t efConstruction,
+      int32_t nthreads,
+      int32_t seed);
+  // k best rows by inner product with the query, best first. ef (>= k) is
+  // the size of the candidate list: larger is slower but more accurate.
+  void search(
+      const DenseMatrix& vectors,
+      const Vector& query,
+      int32_t k,
+      int32_t ef,
+      std::vector<std::pair<real, int32_t>>& results) const;
+  void save(std::ostream&) const;
+  void load(std::istream&);
+};
+
+} // namespace fasttext
@@ -0,0 +1,893 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define FASTTEXT_KERNELS_X86 1
+#include <immintrin.h>
+#else
+#define FASTTEXT_KERNELS_X86 0
+#endif
+
+namespace fasttext {
+
+namespace kernels {
+
+namespace {
+
+real dotScalar(const real* x, const real* y, int64_t n) {
+  real d = 0.0;
+  for (int64_t i = 0; i < n; i++) {
+    d += x[i] * y[i];
+  }
+  return d;
+}
+
+// dot products of x with the 4 consecutive rows of length n starting at y
+void dot4Scalar(const real* x, const real* y, int64_t n, real* out) {
+  for (int32_t r = 0; r < 4; r++) {
+    out[r] = dotScalar(x, y + r * n, n);
+  }
+}
+
+void addScalar(real* y, const real* x, int64_t n) {
+  for (int64_t i = 0; i < n; i++) {
+    y[i] += x[i];
+  }
+}
+
+void addScaledScalar(real* y, const real* x, real a, int64_t n) {
+  for (int64_t i = 0; i < n; i++) {
+    y[i] += a * x[i];
+  }
+}
+
+void scaleScalar(real* x, real a, int64_t n) {
+  for (int64_t i = 0; i < n; i++) {
+    x[i] *= a;
+  }
+}
+
+inline real distanceL2(const real* x, const real* ct, int64_t n, int64_t d) {
+  real dist = 0;
+  for (int64_t i = 0; i < d; i++) {
+    real tmp = x[i] - ct[i * n];
+    dist += tmp * tmp;
+  }
+  return dist;
+}
+
+int64_t nearestL2Scalar(const real* x, const real* ct, int64_t n, int64_t d) {
+  int64_t best = 0;
+  real bestDist = distanceL2(x, ct, n, d);
+  for (int64_t j = 1; j < n; j++) {
+    real dist = distanceL2(x, ct + j, n, d);
+    if (dist < bestDist) {
+      best = j;
+      bestDist = dist;
+    }
+  }
+  return best;
+}
+
+void dotColumnsScalar(
+    const real* x,
+    const real* ct,
+    int64_t n,
+    int64_t d,
+    real* out) {
+  for (int64_t j = 0; j < n; j++) {
+    out[j] = 0;
+  }
+  for (int64_t i = 0; i < d; i++) {
+    for (int64_t j = 0; j < n; j++) {
+      out[j] += x[i] * ct[i * n + j];
+    }
+  }
+}
+
+// exp(x) = 2^k * exp(r), with k = round(x / ln(2)) and exp(r) given by the
+// polynomial of Cephes' expf; ln(2) is split in two parts so that r is exact
+constexpr real kExpMin = -87.0;
+constexpr real kExpMax = 88.0;
+constexpr real kLog2e = 1.44269504088896341;
+constexpr real kLn2Hi = 0.693359375;
+constexpr real kLn2Lo = -2.12194440e-4;
+constexpr real kExpPoly0 = 1.9875691500e-4;
+constexpr real kExpPoly1 = 1.3981999507e-3;
+constexpr real kExpPoly2 = 8.3334519073e-3;
+constexpr real kExpPoly3 = 4.1665795894e-2;
+constexpr real kExpPoly4 = 1.6666665459e-1;
+constexpr real kExpPoly5 = 5.0000001201e-1;
+
+// the vector versions do the same operations in the same order, so that all
+// the implementations give the same results
+inline real expScalar(real x) {
+  x = x > kExpMin ? x : kExpMin;
+  x = x < kExpMax ? x : kExpMax;
+  const real k = std::floor(x * kLog2e + real(0.5));
+  real r = x - k * kLn2Hi;
+  r = r - k * kLn2Lo;
+  real y = kExpPoly0;
+  y = y * r + kExpPoly1;
+  y = y * r + kExpPoly2;
+  y = y * r + kExpPoly3;
+  y = y * r + kExpPoly4;
+  y = y * r + kExpPoly5;
+  y = y * (r * r) + r + real(1.0);
+  const int32_t bits = (int32_t(k) + 127) << 23;
+  real scale;
+  std::memcpy(&scale, &bits, sizeof(scale));
+  return y * scale;
+}
+
+void sigmoidScalar(real* x, int64_t n) {
+  for (int64_t i = 0; i < n; i++) {
+    x[i] = real(1.0) / (real(1.0) + expScalar(-x[i]));
+  }
+}
+
+real expSumScalar(real* x, real shift, int64_t n) {
+  real sum = 0.0;
+  for (int64_t i = 0; i < n; i++) {
+    x[i] = expScalar(x[i] - shift);
+    sum += x[i];
+  }
+  return sum;
+}
+
+real maxScalar(const real* x, int64_t n) {
+  real m = x[0];
+  for (int64_t i = 1; i < n; i++) {
+    m = std::max(x[i], m);
+  }
+  return m;
+}
+
+int64_t findAtLeastScalar(const real* x, int64_t n, real bound) {
+  for (int64_t i = 0; i < n; i++) {
+    if (x[i] >= bound) {
+      return i;
+    }
+  }
+  return n;
+}
+
+// Each lane of the vector kernels keeps the first minimum of its columns;
+// the smallest index among the lanes with the lowest distance is then the
+// first minimum of all the columns.
+inline int64_t firstMinimum(
+    const real* dists,
+    const int32_t* indices,
+    int32_t lanes,
+    real& bestDist) {
+  int32_t best = 0;
+  for (int32_t l = 1; l < lanes; l++) {
+    if (dists[l] < dists[best] ||
+        (dists[l] == dists[best] && indices[l] < indices[best])) {
+      best = l;
+    }
+  }
+  bestDist = dists[best];
+  return indices[best];
+}
+
+#if FASTTEXT_KERNELS_X86
+
+// The element-wise kernels do not use fused multiply-add so that they give
+// exactly the same results as the scalar loops, whatever the CPU.
+
+__attribute__((target("avx2,fma"))) inline real hsumAvx2(
+    __m256 acc0,
+    __m256 acc1) {
+  acc0 = _mm256_add_ps(acc0, acc1);
+  __m128 s = _mm_add_ps(
+      _mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+  s = _mm_hadd_ps(s, s);
+  s = _mm_hadd_ps(s, s);
+  return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma"))) real
+dotAvx2(const real* x, const real* y, int64_t n) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    acc0 = _mm256_fmadd_ps(
+        _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+    acc1 = _mm256_fmadd_ps(
+        _mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), acc1);
+  }
+  if (i + 8 <= n) {
+    acc0 = _mm256_fmadd_ps(
+        _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+    i += 8;
+  }
+  real d = hsumAvx2(acc0, acc1);
+  for (; i < n; i++) {
+    d += x[i] * y[i];
+  }
+  return d;
+}
+
+// Same arithmetic as dotAvx2 for each of the 4 rows, x is only loaded once.
+__attribute__((target("avx2,fma"))) void
+dot4Avx2(const real* x, const real* y, int64_t n, real* out) {
+  const real* y0 = y;
+  const real* y1 = y + n;
+  const real* y2 = y + 2 * n;
+  const real* y3 = y + 3 * n;
+  __m256 a00 = _mm256_setzero_ps(), a01 = _mm256_setzero_ps();
+  __m256 a10 = _mm256_setzero_ps(), a11 = _mm256_setzero_ps();
+  __m256 a20 = _mm256_setzero_ps(), a21 = _mm256_setzero_ps();
+  __m256 a30 = _mm256_setzero_ps(), a31 = _mm256_setzero_ps();
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256 x0 = _mm256_loadu_ps(x + i);
+    const __m256 x1 = _mm256_loadu_ps(x + i + 8);
+    a00 = _mm256_fmadd_ps(x0, _mm256_loadu_ps(y0 + i), a00);
+    a01 = _mm256_fmadd_ps(x1, _mm256_loadu_ps(y0 + i + 8), a01);
+    a10 = _mm256_fmadd_ps(x0, _mm256_loadu_ps(y1 + i), a10);
+    a11 = _mm256_fmadd_ps(x1, _mm256_loadu_ps(y1 + i + 8), a11);
+    a20 = _mm256_fmadd_ps(x0, _mm256_loadu_ps(y2 + i), a20);
+    a21 = _mm256_fmadd_ps(x1, _mm256_loadu_ps(y2 + i + 8), a21);
+    a30 = _mm256_fmadd_ps(x0, _mm256_loadu_ps(y3 + i), a30);
+    a31 = _mm256_fmadd_ps(x1, _mm256_loadu_ps(y3 + i + 8), a31);
+  }
+  if (i + 8 <= n) {
+    const __m256 x0 = _mm256_loadu_ps(x + i);
+    a00 = _mm256_fmadd_ps(x0, _mm256_loadu_ps(y0 + i), a00);
+    a10 = _mm256_fmadd_ps(x0, _mm256_loadu_ps(y1 + i), a10);
+    a20 = _mm256_fmadd_ps(x0, _mm256_loadu_ps(y2 + i), a20);
+    a30 = _mm256_fmadd_ps(x0, _mm256_loadu_ps(y3 + i), a30);
+    i += 8;
+  }
+  real d0 = hsumAvx2(a00, a01);
+  real d1 = hsumAvx2(a10, a11);
+  real d2 = hsumAvx2(a20, a21);
+  real d3 = hsumAvx2(a30, a31);
+  for (; i < n; i++) {
+    d0 += x[i] * y0[i];
+    d1 += x[i] * y1[i];
+    d2 += x[i] * y2[i];
+    d3 += x[i] * y3[i];
+  }
+  out[0] = d0;
+  out[1] = d1;
+  out[2] = d2;
+  out[3] = d3;
+}
+
+__attribute__((target("avx2"))) void
+addAvx2(real* y, const real* x, int64_t n) {
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(
+        y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_loadu_ps(x + i)));
+  }
+  for (; i < n; i++) {
+    y[i] += x[i];
+  }
+}
+
+__attribute__((target("avx2"))) void
+addScaledAvx2(real* y, const real* x, real a, int64_t n) {
+  const __m256 va = _mm256_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 ax = _mm256_mul_ps(va, _mm256_loadu_ps(x + i));
+    _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), ax));
+  }
+  for (; i < n; i++) {
+    y[i] += a * x[i];
+  }
+}
+
+__attribute__((target("avx2"))) void scaleAvx2(real* x, real a, int64_t n) {
+  const __m256 va = _mm256_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(x + i, _mm256_mul_ps(_mm256_loadu_ps(x + i), va));
+  }
+  for (; i < n; i++) {
+    x[i] *= a;
+  }
+}
+
+__attribute__((target("avx2"))) int64_t
+nearestL2Avx2(const real* x, const real* ct, int64_t n, int64_t d) {
+  __m256 bestDists = _mm256_set1_ps(std::numeric_limits<real>::infinity());
+  __m256i bestIndices = _mm256_setzero_si256();
+  __m256i indices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i step = _mm256_set1_epi32(8);
+  int64_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    __m256 dist = _mm256_setzero_ps();
+    for (int64_t i = 0; i < d; i++) {
+      const __m256 t =
+          _mm256_sub_ps(_mm256_set1_ps(x[i]), _mm256_loadu_ps(ct + i * n + j));
+      dist = _mm256_add_ps(dist, _mm256_mul_ps(t, t));
+    }
+    const __m256 closer = _mm256_cmp_ps(dist, bestDists, _CMP_LT_OQ);
+    bestDists = _mm256_blendv_ps(bestDists, dist, closer);
+    bestIndices = _mm256_castps_si256(_mm256_blendv_ps(
+        _mm256_castsi256_ps(bestIndices),
+        _mm256_castsi256_ps(indices),
+        closer));
+    indices = _mm256_add_epi32(indices, step);
+  }
+  real dists[8];
+  int32_t lanesIndices[8];
+  _mm256_storeu_ps(dists, bestDists);
+  _mm256_storeu_si256((__m256i*)lanesIndices, bestIndices);
+  real bestDist;
+  int64_t best = firstMinimum(dists, lanesIndices, j > 0 ? 8 : 1, bestDist);
+  for (; j < n; j++) {
+    real dist = distanceL2(x, ct + j, n, d);
+    if (j == 0 || dist < bestDist) {
+      best = j;
+      bestDist = dist;
+    }
+  }
+  return best;
+}
+
+__attribute__((target("avx2"))) void dotColumnsAvx2(
+    const real* x,
+    const real* ct,
+    int64_t n,
+    int64_t d,
+    real* out) {
+  int64_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    __m256 dot = _mm256_setzero_ps();
+    for (int64_t i = 0; i < d; i++) {
+      dot = _mm256_add_ps(
+          dot,
+          _mm256_mul_ps(
+              _mm256_set1_ps(x[i]), _mm256_loadu_ps(ct + i * n + j)));
+    }
+    _mm256_storeu_ps(out + j, dot);
+  }
+  for (; j < n; j++) {
+    real dot = 0;
+    for (int64_t i = 0; i < d; i++) {
+      dot += x[i] * ct[i * n + j];
+    }
+    out[j] = dot;
+  }
+}
+
+__attribute__((target("avx2"))) inline __m256 expAvx2(__m256 x) {
+  x = _mm256_max_ps(x, _mm256_set1_ps(kExpMin));
+  x = _mm256_min_ps(x, _mm256_set1_ps(kExpMax));
+  const __m256 k = _mm256_floor_ps(_mm256_add_ps(
+      _mm256_mul_ps(x, _mm256_set1_ps(kLog2e)), _mm256_set1_ps(0.5)));
+  __m256 r = _mm256_sub_ps(x, _mm256_mul_ps(k, _mm256_set1_ps(kLn2Hi)));
+  r = _mm256_sub_ps(r, _mm256_mul_ps(k, _mm256_set1_ps(kLn2Lo)));
+  __m256 y = _mm256_set1_ps(kExpPoly0);
+  y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(kExpPoly1));
+  y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(kExpPoly2));
+  y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(kExpPoly3));
+  y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(kExpPoly4));
+  y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(kExpPoly5));
+  y = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(y, _mm256_mul_ps(r, r)), r),
+      _mm256_set1_ps(1.0));
+  const __m256i bits = _mm256_slli_epi32(
+      _mm256_add_epi32(_mm256_cvttps_epi32(k), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(bits));
+}
+
+__attribute__((target("avx2"))) void sigmoidAvx2(real* x, int64_t n) {
+  const __m256 one = _mm256_set1_ps(1.0);
+  const __m256 sign = _mm256_set1_ps(-0.0);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 e = expAvx2(_mm256_xor_ps(_mm256_loadu_ps(x + i), sign));
+    _mm256_storeu_ps(x + i, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+  }
+  sigmoidScalar(x + i, n - i);
+}
+
+__attribute__((target("avx2"))) real
+expSumAvx2(real* x, real shift, int64_t n) {
+  const __m256 vshift = _mm256_set1_ps(shift);
+  __m256 acc = _mm256_setzero_ps();
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 e = expAvx2(_mm256_sub_ps(_mm256_loadu_ps(x + i), vshift));
+    _mm256_storeu_ps(x + i, e);
+    acc = _mm256_add_ps(acc, e);
+  }
+  real lanes[8];
+  _mm256_storeu_ps(lanes, acc);
+  real sum = 0.0;
+  for (int32_t l = 0; l < 8; l++) {
+    sum += lanes[l];
+  }
+  return sum + expSumScalar(x + i, shift, n - i);
+}
+
+__attribute__((target("avx2"))) real maxAvx2(const real* x, int64_t n) {
+  if (n < 8) {
+    return maxScalar(x, n);
+  }
+  __m256 m = _mm256_loadu_ps(x);
+  int64_t i = 8;
+  for (; i + 8 <= n; i += 8) {
+    m = _mm256_max_ps(_mm256_loadu_ps(x + i), m);
+  }
+  real lanes[8];
+  _mm256_storeu_ps(lanes, m);
+  real result = maxScalar(lanes, 8);
+  for (; i < n; i++) {
+    result = std::max(x[i], result);
+  }
+  return result;
+}
+
+__attribute__((target("avx2"))) int64_t
+findAtLeastAvx2(const real* x, int64_t n, real bound) {
+  const __m256 vbound = _mm256_set1_ps(bound);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const int found = _mm256_movemask_ps(
+        _mm256_cmp_ps(_mm256_loadu_ps(x + i), vbound, _CMP_GE_OQ));
+    if (found) {
+      return i + __builtin_ctz(found);
+    }
+  }
+  return i + findAtLeastScalar(x + i, n - i, bound);
+}
+
+// AVX-512 kernels handle the remainder with masked loads and stores.
+
+__attribute__((target("avx512f"))) inline __mmask16 tailMask(int64_t r) {
+  return (__mmask16)((1u << r) - 1);
+}
+
+// gcc contracts a multiply followed by an add into a fused multiply-add,
+// which AVX-512 always provides; an explicit rounding mode prevents it.
+__attribute__((target("avx512f"))) inline __m512 mulNoContract(
+    __m512 a,
+    __m512 b) {
+  return _mm512_maskz_mul_round_ps(
+      0xFFFF, a, b, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+
+// horizontal sum: fold the 256-bit halves, then the 128-bit lanes (the
+// zero-masking forms avoid spurious -Wuninitialized warnings from gcc)
+__attribute__((target("avx512f"))) inline real hsumAvx512(
+    __m512 acc0,
+    __m512 acc1) {
+  acc0 = _mm512_add_ps(acc0, acc1);
+  acc0 = _mm512_add_ps(
+      acc0,
+      _mm512_maskz_shuffle_f32x4(
+          0xFFFF, acc0, acc0, _MM_SHUFFLE(1, 0, 3, 2)));
+  acc0 = _mm512_add_ps(
+      acc0,
+      _mm512_maskz_shuffle_f32x4(
+          0xFFFF, acc0, acc0, _MM_SHUFFLE(2, 3, 0, 1)));
+  __m128 s = _mm512_maskz_extractf32x4_ps(0xF, acc0, 0);
+  s = _mm_hadd_ps(s, s);
+  s = _mm_hadd_ps(s, s);
+  return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx512f"))) real
+dotAvx512(const real* x, const real* y, int64_t n) {
+  __m512 acc0 = _mm512_setzero_ps();
+  __m512 acc1 = _mm512_setzero_ps();
+  int64_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    acc0 = _mm512_fmadd_ps(
+        _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), acc0);
+    acc1 = _mm512_fmadd_ps(
+        _mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16), acc1);
+  }
+  if (i + 16 <= n) {
+    acc0 = _mm512_fmadd_ps(
+        _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), acc0);
+    i += 16;
+  }
+  if (i < n) {
+    const __mmask16 mask = tailMask(n - i);
+    acc1 = _mm512_fmadd_ps(
+        _mm512_maskz_loadu_ps(mask, x + i),
+        _mm512_maskz_loadu_ps(mask, y + i),
+        acc1);
+  }
+  return hsumAvx512(acc0, acc1);
+}
+
+// Same arithmetic as dotAvx512 for each of the 4 rows, x is only loaded once.
+__attribute__((target("avx512f"))) void
+dot4Avx512(const real* x, const real* y, int64_t n, real* out) {
+  const real* y0 = y;
+  const real* y1 = y + n;
+  const real* y2 = y + 2 * n;
+  const real* y3 = y + 3 * n;
+  __m512 a00 = _mm512_setzero_ps(), a01 = _mm512_setzero_ps();
+  __m512 a10 = _mm512_setzero_ps(), a11 = _mm512_setzero_ps();
+  __m512 a20 = _mm512_setzero_ps(), a21 = _mm512_setzero_ps();
+  __m512 a30 = _mm512_setzero_ps(), a31 = _mm512_setzero_ps();
+  int64_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const __m512 x0 = _mm512_loadu_ps(x + i);
+    const __m512 x1 = _mm512_loadu_ps(x + i + 16);
+    a00 = _mm512_fmadd_ps(x0, _mm512_loadu_ps(y0 + i), a00);
+    a01 = _mm512_fmadd_ps(x1, _mm512_loadu_ps(y0 + i + 16), a01);
+    a10 = _mm512_fmadd_ps(x0, _mm512_loadu_ps(y1 + i), a10);
+    a11 = _mm512_fmadd_ps(x1, _mm512_loadu_ps(y1 + i + 16), a11);
+    a20 = _mm512_fmadd_ps(x0, _mm512_loadu_ps(y2 + i), a20);
+    a21 = _mm512_fmadd_ps(x1, _mm512_loadu_ps(y2 + i + 16), a21);
+    a30 = _mm512_fmadd_ps(x0, _mm512_loadu_ps(y3 + i), a30);
+    a31 = _mm512_fmadd_ps(x1, _mm512_loadu_ps(y3 + i + 16), a31);
+  }
+  if (i + 16 <= n) {
+    const __m512 x0 = _mm512_loadu_ps(x + i);
+    a00 = _mm512_fmadd_ps(x0, _mm512_loadu_ps(y0 + i), a00);
+    a10 = _mm512_fmadd_ps(x0, _mm512_loadu_ps(y1 + i), a10);
+    a20 = _mm512_fmadd_ps(x0, _mm512_loadu_ps(y2 + i), a20);
+    a30 = _mm512_fmadd_ps(x0, _mm512_loadu_ps(y3 + i), a30);
+    i += 16;
+  }
+  if (i < n) {
+    const __mmask16 mask = tailMask(n - i);
+    const __m512 x0 = _mm512_maskz_loadu_ps(mask, x + i);
+    a01 = _mm512_fmadd_ps(x0, _mm512_maskz_loadu_ps(mask, y0 + i), a01);
+    a11 = _mm512_fmadd_ps(x0, _mm512_maskz_loadu_ps(mask, y1 + i), a11);
+    a21 = _mm512_fmadd_ps(x0, _mm512_maskz_loadu_ps(mask, y2 + i), a21);
+    a31 = _mm512_fmadd_ps(x0, _mm512_maskz_loadu_ps(mask, y3 + i), a31);
+  }
+  out[0] = hsumAvx512(a00, a01);
+  out[1] = hsumAvx512(a10, a11);
+  out[2] = hsumAvx512(a20, a21);
+  out[3] = hsumAvx512(a30, a31);
+}
+
+__attribute__((target("avx512f"))) void
+addAvx512(real* y, const real* x, int64_t n) {
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(
+        y + i, _mm512_add_ps(_mm512_loadu_ps(y + i), _mm512_loadu_ps(x + i)));
+  }
+  if (i < n) {
+    const __mmask16 mask = tailMask(n - i);
+    __m512 vy = _mm512_maskz_loadu_ps(mask, y + i);
+    __m512 vx = _mm512_maskz_loadu_ps(mask, x + i);
+    _mm512_mask_storeu_ps(y + i, mask, _mm512_add_ps(vy, vx));
+  }
+}
+
+__attribute__((target("avx512f"))) void
+addScaledAvx512(real* y, const real* x, real a, int64_t n) {
+  const __m512 va = _mm512_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 ax = mulNoContract(va, _mm512_loadu_ps(x + i));
+    _mm512_storeu_ps(y + i, _mm512_add_ps(_mm512_loadu_ps(y + i), ax));
+  }
+  if (i < n) {
+    const __mmask16 mask = tailMask(n - i);
+    __m512 ax = mulNoContract(va, _mm512_maskz_loadu_ps(mask, x + i));
+    __m512 vy = _mm512_maskz_loadu_ps(mask, y + i);
+    _mm512_mask_storeu_ps(y + i, mask, _mm512_add_ps(vy, ax));
+  }
+}
+
+__attribute__((target("avx512f"))) void
+scaleAvx512(real* x, real a, int64_t n) {
+  const __m512 va = _mm512_set1_ps(a);
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(x + i, _mm512_mul_ps(_mm512_loadu_ps(x + i), va));
+  }
+  if (i < n) {
+    const __mmask16 mask = tailMask(n - i);
+    __m512 vx = _mm512_maskz_loadu_ps(mask, x + i);
+    _mm512_mask_storeu_ps(x + i, mask, _mm512_mul_ps(vx, va));
+  }
+}
+
+__attribute__((target("avx512f"))) int64_t
+nearestL2Avx512(const real* x, const real* ct, int64_t n, int64_t d) {
+  __m512 bestDists = _mm512_set1_ps(std::numeric_limits<real>::infinity());
+  __m512i bestIndices = _mm512_setzero_si512();
+  __m512i indices = _mm512_setr_epi32(
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  const __m512i step = _mm512_set1_epi32(16);
+  for (int64_t j = 0; j < n; j += 16) {
+    const __mmask16 mask = tailMask(std::min<int64_t>(n - j, 16));
+    __m512 dist = _mm512_setzero_ps();
+    for (int64_t i = 0; i < d; i++) {
+      const __m512 t = _mm512_sub_ps(
+          _mm512_set1_ps(x[i]), _mm512_maskz_loadu_ps(mask, ct + i * n + j));
+      dist = _mm512_add_ps(dist, mulNoContract(t, t));
+    }
+    const __mmask16 closer =
+        _mm512_mask_cmp_ps_mask(mask, dist, bestDists, _CMP_LT_OQ);
+    bestDists = _mm512_mask_mov_ps(bestDists, closer, dist);
+    bestIndices = _mm512_mask_mov_epi32(bestIndices, closer, indices);
+    indices = _mm512_add_epi32(indices, step);
+  }
+  real dists[16];
+  int32_t lanesIndices[16];
+  _mm512_storeu_ps(dists, bestDists);
+  _mm512_storeu_si512(lanesIndices, bestIndices);
+  real bestDist;
+  return firstMinimum(dists, lanesIndices, 16, bestDist);
+}
+
+__attribute__((target("avx512f"))) void dotColumnsAvx512(
+    const real* x,
+    const real* ct,
+    int64_t n,
+    int64_t d,
+    real* out) {
+  for (int64_t j = 0; j < n; j += 16) {
+    const __mmask16 mask = tailMask(std::min<int64_t>(n - j, 16));
+    __m512 dot = _mm512_setzero_ps();
+    for (int64_t i = 0; i < d; i++) {
+      dot = _mm512_add_ps(
+          dot,
+          mulNoContract(
+              _mm512_set1_ps(x[i]),
+              _mm512_maskz_loadu_ps(mask, ct + i * n + j)));
+    }
+    _mm512_mask_storeu_ps(out + j, mask, dot);
+  }
+}
+
+// the unmasked forms of some of the intrinsics below take an undefined source,
+// on which GCC 12 warns: their masked forms are used with all the lanes set
+constexpr __mmask16 kAllLanes = 0xFFFF;
+
+__attribute__((target("avx512f"))) inline __m512 expAvx512(__m512 x) {
+  x = _mm512_mask_max_ps(x, kAllLanes, x, _mm512_set1_ps(kExpMin));
+  x = _mm512_mask_min_ps(x, kAllLanes, x, _mm512_set1_ps(kExpMax));
+  __m512 k = _mm512_add_ps(
+      mulNoContract(x, _mm512_set1_ps(kLog2e)), _mm512_set1_ps(0.5));
+  k = _mm512_mask_roundscale_ps(
+      k, kAllLanes, k, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+  __m512 r = _mm512_sub_ps(x, mulNoContract(k, _mm512_set1_ps(kLn2Hi)));
+  r = _mm512_sub_ps(r, mulNoContract(k, _mm512_set1_ps(kLn2Lo)));
+  __m512 y = _mm512_set1_ps(kExpPoly0);
+  y = _mm512_add_ps(mulNoContract(y, r), _mm512_set1_ps(kExpPoly1));
+  y = _mm512_add_ps(mulNoContract(y, r), _mm512_set1_ps(kExpPoly2));
+  y = _mm512_add_ps(mulNoContract(y, r), _mm512_set1_ps(kExpPoly3));
+  y = _mm512_add_ps(mulNoContract(y, r), _mm512_set1_ps(kExpPoly4));
+  y = _mm512_add_ps(mulNoContract(y, r), _mm512_set1_ps(kExpPoly5));
+  y = _mm512_add_ps(
+      _mm512_add_ps(mulNoContract(y, mulNoContract(r, r)), r),
+      _mm512_set1_ps(1.0));
+  __m512i bits = _mm512_add_epi32(
+      _mm512_mask_cvttps_epi32(_mm512_setzero_si512(), kAllLanes, k),
+      _mm512_set1_epi32(127));
+  bits = _mm512_mask_slli_epi32(bits, kAllLanes, bits, 23);
+  return mulNoContract(y, _mm512_castsi512_ps(bits));
+}
+
+__attribute__((target("avx512f"))) void sigmoidAvx512(real* x, int64_t n) {
+  const __m512 one = _mm512_set1_ps(1.0);
+  for (int64_t i = 0; i < n; i += 16) {
+    const __mmask16 mask = tailMask(std::min<int64_t>(n - i, 16));
+    const __m512 e = expAvx512(
+        _mm512_sub_ps(_mm512_setzero_ps(), _mm512_maskz_loadu_ps(mask, x + i)));
+    _mm512_mask_storeu_ps(
+        x + i, mask, _mm512_div_ps(one, _mm512_add_ps(one, e)));
+  }
+}
+
+__attribute__((target("avx512f"))) real
+expSumAvx512(real* x, real shift, int64_t n) {
+  const __m512 vshift = _mm512_set1_ps(shift);
+  __m512 acc = _mm512_setzero_ps();
+  for (int64_t i = 0; i < n; i += 16) {
+    const __mmask16 mask = tailMask(std::min<int64_t>(n - i, 16));
+    const __m512 e = expAvx512(
+        _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, x + i), vshift));
+    _mm512_mask_storeu_ps(x + i, mask, e);
+    acc = _mm512_mask_add_ps(acc, mask, acc, e);
+  }
+  return hsumAvx512(acc, _mm512_setzero_ps());
+}
+
+__attribute__((target("avx512f"))) real maxAvx512(const real* x, int64_t n) {
+  __m512 m = _mm512_set1_ps(x[0]);
+  for (int64_t i = 0; i < n; i += 16) {
+    const __mmask16 mask = tailMask(std::min<int64_t>(n - i, 16));
+    m = _mm512_mask_max_ps(m, mask, _mm512_maskz_loadu_ps(mask, x + i), m);
+  }
+  real lanes[16];
+  _mm512_storeu_ps(lanes, m);
+  return maxScalar(lanes, 16);
+}
+
+__attribute__((target("avx512f"))) int64_t
+findAtLeastAvx512(const real* x, int64_t n, real bound) {
+  const __m512 vbound = _mm512_set1_ps(bound);
+  for (int64_t i = 0; i < n; i += 16) {
+    const __mmask16 mask = tailMask(std::min<int64_t>(n - i, 16));
+    const __mmask16 found = _mm512_mask_cmp_ps_mask(
+        mask, _mm512_maskz_loadu_ps(mask, x + i), vbound, _CMP_GE_OQ);
+    if (found) {
+      return i + __builtin_ctz(found);
+    }
+  }
+  return n;
+}
+
+#endif
+
+struct Dispatch {
+  const char* isa;
+  real (*dot)(const real*, const real*, int64_t);
+  void (*dot4)(const real*, const real*, int64_t, real*);
+  void (*add)(real*, const real*, int64_t);
+  void (*addScaled)(real*, const real*, real, int64_t);
+  void (*scale)(real*, real, int64_t);
+  int64_t (*nearestL2)(const real*, const real*, int64_t, int64_t);
+  void (*dotColumns)(const real*, const real*, int64_t, int64_t, real*);
+  void (*sigmoid)(real*, int64_t);
+  real (*expSum)(real*, real, int64_t);
+  real (*max)(const real*, int64_t);
+  int64_t (*findAtLeast)(const real*, int64_t, real);
+};
+
+Dispatch select() {
+#if FASTTEXT_KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return {"avx512",
+            dotAvx512,
+            dot4Avx512,
+            addAvx512,
+            addScaledAvx512,
+            scaleAvx512,
+            nearestL2Avx512,
+            dotColumnsAvx512,
+            sigmoidAvx512,
+            expSumAvx512,
+            maxAvx512,
+            findAtLeastAvx512};
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return {"avx2",
+            dotAvx2,
+            dot4Avx2,
+            addAvx2,
+            addScaledAvx2,
+            scaleAvx2,
+            nearestL2Avx2,
+            dotColumnsAvx2,
+            sigmoidAvx2,
+            expSumAvx2,
+            maxAvx2,
+            findAtLeastAvx2};
+  }
+#endif
+  return {"scalar",
+          dotScalar,
+          dot4Scalar,
+          addScalar,
+          addScaledScalar,
+          scaleScalar,
+          nearestL2Scalar,
+          dotColumnsScalar,
+          sigmoidScalar,
+          expSumScalar,
+          maxScalar,
+          findAtLeastScalar};
+}
+
+const Dispatch dispatch = select();
+
+// bytes of the rows of b kept in the cache by gemm
+constexpr int64_t kGemmBlockBytes = 128 * 1024;
+
+} // namespace
+
+real dot(const real* x, const real* y, int64_t n) {
+  return dispatch.dot(x, y, n);
+}
+
+void add(real* y, const real* x, int64_t n) {
+  dispatch.add(y, x, n);
+}
+
+void addScaled(real* y, const real* x, real a, int64_t n) {
+  dispatch.addScaled(y, x, a, n);
+}
+
+void scale(real* x, real a, int64_t n) {
+  dispatch.scale(x, a, n);
+}
+
+void gemm(
+    const real* a,
+    const real* b,
+    real* c,
+    int64_t m,
+    int64_t n,
+    int64_t k,
+    int64_t ldc) {
+  int64_t block = kGemmBlockBytes / (std::max<int64_t>(k, 1) * sizeof(real));
+  block = std::max<int64_t>(4, block - block % 4);
+  for (int64_t j0 = 0; j0 < n; j0 += block) {
+    const int64_t j1 = std::min(n, j0 + block);
+    for (int64_t i = 0; i < m; i++) {
+      const real* x = a + i * k;
+      real* out = c + i * ldc;
+      int64_t j = j0;
+      for (; j + 4 <= j1; j += 4) {
+        dispatch.dot4(x, b + j * k, k, out + j);
+      }
+      for (; j < j1; j++) {
+        out[j] = dispatch.dot(x, b + j * k, k);
+      }
+    }
+  }
+}
+
+int64_t nearestL2(const real* x, const real* ct, int64_t n, int64_t d) {
+  return dispatch.nearestL2(x, ct, n, d);
+}
+
+void dotColumns(
+    const real* x,
+    const real* ct,
+    int64_t n,
+    int64_t d,
+    real* out) {
+  dispatch.dotColumns(x, ct, n, d, out);
+}
+
+void sigmoid(real* x, int64_t n) {
+  dispatch.sigmoid(x, n);
+}
+
+real expSum(real* x, real shift, int64_t n) {
+  return dispatch.expSum(x, shift, n);
+}
+
+real max(const real* x, int64_t n) {
+  return dispatch.max(x, n);
+}
+
+int64_t findAtLeast(const real* x, int64_t n, real bound) {
+  return dispatch.findAtLeast(x, n, bound);
+}
+
+bool hasNaN(const real* x, int64_t n) {
+  // branch-free so that the loop stays a single cheap pass
+  bool nan = false;
+  for (int64_t i = 0; i < n; i++) {
+    nan |= std::isnan(x[i]);
+  }
+  return nan;
+}
+
+const char* isa() {
+  return dispatch.isa;
+}
+
+} // namespace kernels
+
+} // namespace fasttext
@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "real.h"
+
+namespace fasttext {
+
+// Vectorized inner loops shared by the matrix and vector classes.
+// The implementation (AVX-512, AVX2 or scalar) is selected once at startup
+// from the features of the running CPU. Pointers do not need to be aligned.
+namespace kernels {
+
+// returns sum_i x[i] * y[i]
+real dot(const real* x, const real* y, int64_t n);
+
+// y += x
+void add(real* y, const real* x, int64_t n);
+
+// y += a * x
+void addScaled(real* y, const real* x, real a, int64_t n);
+
+// x *= a
+void scale(real* x, real a, int64_t n);
+
+// c[i * ldc + j] = dot(a + i * k, b + j * k, k) for i < m and j < n: the
+// product of a (m x k) by the transpose of b (n x k), both row major. Each
+// element is computed exactly as dot() would; the rows of b are processed by
+// blocks that stay in the cache for all the rows of a.
+void gemm(
+    const real* a,
+    const real* b,
+    real* c,
+    int64_t m,
+    int64_t n,
+    int64_t k,
+    int64_t ldc);
+
+// Index of the column of ct (d x n, row major) nearest to x (of length d):
+// the first j minimizing sum_i (x[i] - ct[i * n + j])^2, each distance being
+// summed in the order of the scalar loop over i, without fused operations.
+int64_t nearestL2(const real* x, const real* ct, int64_t n, int64_t d);
+
+// out[j] = sum_i x[i] * ct[i * n + j] for j < n: the dot products of x (of
+// length d) with the columns of ct (d x n, row major), summed in the order of
+// the scalar loop over i without fused operations.
+void dotColumns(const real* x, const real* ct, int64_t n, int64_t d, real* out);
+
+// x[i] = 1 / (1 + exp(-x[i]))
+void sigmoid(real* x, int64_t n);
+
+// x[i] = exp(x[i] - shift), returns the sum of the results
+real expSum(real* x, real shift, int64_t n);
+
+// The exponential of sigmoid and expSum is the approximation of Cephes' expf
+// (within 2 ulp), computed with the same operations by all the
+// implementations; its argument is clamped to [-87, 88].
+
+// largest element of x, which is not empty
+real max(const real* x, int64_t n);
+
+// index of the first element of x at least equal to bound, n if none is
+int64_t findAtLeast(const real* x, int64_t n, real bound);
+
+bool hasNaN(const real* x, int64_t n);
+
+// name of the selected implementation: "avx512", "avx2" or "scalar"
+const char* isa();
+
+} // namespace kernels
+
+} // namespace fasttext
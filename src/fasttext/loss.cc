@@ -7,9 +7,11 @@
  */
 
 #include "loss.h"
+#include "kernels.h"
 #include "utils.h"
 
 #include <cmath>
+#include <stdexcept>
 
 namespace fasttext {
 
@@ -23,10 +25,24 @@ bool comparePairs(
   return l.first > r.first;
 }
 
+// order of the max-heap of the frontier of the hierarchical softmax search
+bool compareScores(
+    const std::pair<real, int32_t>& l,
+    const std::pair<real, int32_t>& r) {
+  return l.first < r.first;
+}
+
 real std_log(real x) {
   return std::log(x + 1e-5);
 }
 
+void checkTraining(bool training) {
+  if (!training) {
+    throw std::logic_error(
+        "The model was loaded for inference only and can not be trained");
+  }
+}
+
 Loss::Loss(std::shared_ptr<Matrix>& wo) : wo_(wo) {
   t_sigmoid_.reserve(SIGMOID_TABLE_SIZE + 1);
   for (int i = 0; i < SIGMOID_TABLE_SIZE + 1; i++) {
@@ -67,7 +83,31 @@ void Loss::predict(
     Predictions& heap,
     Model::State& state) const {
   computeOutput(state);
-  findKBest(k, threshold, heap, state.output);
+  predictFromOutput(
+      k, threshold, heap, state.output.data(), state.output.size());
+}
+
+void Loss::predict(
+    int32_t k,
+    real threshold,
+    const std::vector<int64_t>& inputs,
+    std::vector<Predictions>& heaps,
+    Model::BatchState& batch) const {
+  const int64_t dim = batch.hidden.cols();
+  for (int64_t i : inputs) {
+    const real* hidden = batch.hidden.data() + i * dim;
+    std::copy(hidden, hidden + dim, batch.state.hidden.data());
+    predict(k, threshold, heaps[i], batch.state);
+  }
+}
+
+void Loss::predictFromOutput(
+    int32_t k,
+    real threshold,
+    Predictions& heap,
+    const real* output,
+    int64_t osz) const {
+  findKBest(k, threshold, heap, output, osz);
   std::sort_heap(heap.begin(), heap.end(), comparePairs);
 }
 
@@ -75,20 +115,32 @@ void Loss::findKBest(
     int32_t k,
     real threshold,
     Predictions& heap,
-    const Vector& output) const {
-  for (int32_t i = 0; i < output.size(); i++) {
-    if (output[i] < threshold) {
-      continue;
-    }
-    if (heap.size() == k && std_log(output[i]) < heap.front().first) {
+    const real* output,
+    int64_t osz) const {
+  // the scan skips every output below the threshold and, once the heap is
+  // full, clearly below the output of its smallest score. The candidates are
+  // then compared on their scores (std_log), so that outputs with the same
+  // score, such as the ones at the 1e-5 floor of std_log, are kept in the
+  // same order as by a comparison of every score.
+  real bound = threshold;
+  for (int64_t i = kernels::findAtLeast(output, osz, bound); i < osz;
+       i += 1 + kernels::findAtLeast(output + i + 1, osz - i - 1, bound)) {
+    const real score = std_log(output[i]);
+    if (heap.size() == static_cast<size_t>(k) && score < heap.front().first) {
       continue;
     }
-    heap.push_back(std::make_pair(std_log(output[i]), i));
+    heap.push_back(std::make_pair(score, int32_t(i)));
     std::push_heap(heap.begin(), heap.end(), comparePairs);
     if (heap.size() > k) {
       std::pop_heap(heap.begin(), heap.end(), comparePairs);
       heap.pop_back();
     }
+    if (!heap.empty() && heap.size() == static_cast<size_t>(k)) {
+      // below the outputs of all the scores of at least heap.front().first,
+      // with a margin for the rounding errors of std_log
+      real minOutput = std::exp(heap.front().first) * (1.0 - 1e-3) - 1e-5;
+      bound = std::max(threshold, minOutput);
+    }
   }
 }
 
@@ -101,11 +153,12 @@ real BinaryLogisticLoss::binaryLogistic(
     bool labelIsPositive,
     real lr,
     bool backprop) const {
-  real score = sigmoid(wo_->dotRow(state.hidden, target));
+  Matrix& wo = outputMatrix(state);
+  real score = sigmoid(wo.dotRow(state.hidden, target));
   if (backprop) {
     real alpha = lr * (real(labelIsPositive) - score);
-    state.grad.addRow(*wo_, target, alpha);
-    wo_->addVectorToRow(state.hidden, target, alpha);
+    state.grad.addRow(wo, target, alpha);
+    wo.addVectorToRow(state.hidden, target, alpha);
   }
   if (labelIsPositive) {
     return -log(score);
@@ -116,11 +169,12 @@ real BinaryLogisticLoss::binaryLogistic(
 
 void BinaryLogisticLoss::computeOutput(Model::State& state) const {
   Vector& output = state.output;
-  output.mul(*wo_, state.hidden);
-  int32_t osz = output.size();
-  for (int32_t i = 0; i < osz; i++) {
-    output[i] = sigmoid(output[i]);
-  }
+  output.mul(outputMatrix(state), state.hidden);
+  activate(output.data(), output.size());
+}
+
+void BinaryLogisticLoss::activate(real* output, int64_t osz) const {
+  kernels::sigmoid(output, osz);
 }
 
 OneVsAllLoss::OneVsAllLoss(std::shared_ptr<Matrix>& wo)
@@ -145,20 +199,47 @@ real OneVsAllLoss::forward(
 NegativeSamplingLoss::NegativeSamplingLoss(
     std::shared_ptr<Matrix>& wo,
     int neg,
-    const std::vector<int64_t>& targetCounts)
-    : BinaryLogisticLoss(wo), neg_(neg), negatives_(), uniform_() {
-  real z = 0.0;
-  for (size_t i = 0; i < targetCounts.size(); i++) {
+    const std::vector<int64_t>& targetCounts,
+    bool training)
+    : BinaryLogisticLoss(wo), neg_(neg), aliases_(), drawLimit_(0) {
+  if (!training) {
+    return;
+  }
+  // Vose's alias method: columns with a probability below the average one
+  // are filled up by a target above it, which then becomes lower
+  const int32_t n = targetCounts.size();
+  double z = 0.0;
+  for (int32_t i = 0; i < n; i++) {
     z += pow(targetCounts[i], 0.5);
   }
-  for (size_t i = 0; i < targetCounts.size(); i++) {
-    real c = pow(targetCounts[i], 0.5);
-    for (size_t j = 0; j < c * NegativeSamplingLoss::NEGATIVE_TABLE_SIZE / z;
-         j++) {
-      negatives_.push_back(i);
+  std::vector<double> p(n);
+  std::vector<int32_t> small, large;
+  for (int32_t i = 0; i < n; i++) {
+    p[i] = pow(targetCounts[i], 0.5) * n / z;
+    (p[i] < 1.0 ? small : large).push_back(i);
+  }
+  const uint64_t draws = std::minstd_rand::max() - std::minstd_rand::min() + 1;
+  const uint32_t full = draws / n;
+  drawLimit_ = uint64_t(full) * n;
+  aliases_.resize(n);
+  while (!small.empty() && !large.empty()) {
+    int32_t s = small.back();
+    int32_t l = large.back();
+    small.pop_back();
+    aliases_[s] = {static_cast<uint32_t>(std::round(p[s] * full)), l};
+    p[l] -= 1.0 - p[s];
+    if (p[l] < 1.0) {
+      large.pop_back();
+      small.push_back(l);
     }
   }
-  uniform_ = std::uniform_int_distribution<size_t>(0, negatives_.size() - 1);
+  // the remaining columns are full, up to rounding errors
+  for (int32_t i : large) {
+    aliases_[i] = {full, i};
+  }
+  for (int32_t i : small) {
+    aliases_[i] = {full, i};
+  }
 }
 
 real NegativeSamplingLoss::forward(
@@ -169,6 +250,7 @@ real NegativeSamplingLoss::forward(
     bool backprop) {
   assert(targetIndex >= 0);
   assert(targetIndex < targets.size());
+  checkTraining(!aliases_.empty());
   int32_t target = targets[targetIndex];
   real loss = binaryLogistic(target, state, true, lr, backprop);
 
@@ -182,65 +264,73 @@ real NegativeSamplingLoss::forward(
 int32_t NegativeSamplingLoss::getNegative(
     int32_t target,
     std::minstd_rand& rng) {
+  const uint64_t n = aliases_.size();
   int32_t negative;
   do {
-    negative = negatives_[uniform_(rng)];
+    uint64_t x;
+    do {
+      x = rng() - std::minstd_rand::min();
+    } while (x >= drawLimit_);
+    const int32_t i = x % n;
+    negative = x / n < aliases_[i].threshold ? i : aliases_[i].alias;
   } while (target == negative);
   return negative;
 }
 
 HierarchicalSoftmaxLoss::HierarchicalSoftmaxLoss(
     std::shared_ptr<Matrix>& wo,
-    const std::vector<int64_t>& targetCounts)
+    const std::vector<int64_t>& targetCounts,
+    bool training)
     : BinaryLogisticLoss(wo),
-      paths_(),
-      codes_(),
-      tree_(),
+      pathOffsets_(),
+      pathNodes_(),
+      pathCodes_(),
+      children_(),
       osz_(targetCounts.size()) {
-  buildTree(targetCounts);
+  buildTree(targetCounts, training);
 }
 
-void HierarchicalSoftmaxLoss::buildTree(const std::vector<int64_t>& counts) {
-  tree_.resize(2 * osz_ - 1);
-  for (int32_t i = 0; i < 2 * osz_ - 1; i++) {
-    tree_[i].parent = -1;
-    tree_[i].left = -1;
-    tree_[i].right = -1;
-    tree_[i].count = 1e15;
-    tree_[i].binary = false;
-  }
+void HierarchicalSoftmaxLoss::buildTree(
+    const std::vector<int64_t>& counts,
+    bool paths) {
+  struct Node {
+    int32_t parent;
+    int64_t count;
+    bool binary;
+  };
+  std::vector<Node> tree(2 * osz_ - 1, Node{-1, int64_t(1e15), false});
   for (int32_t i = 0; i < osz_; i++) {
-    tree_[i].count = counts[i];
+    tree[i].count = counts[i];
   }
+  children_.resize(osz_ - 1);
   int32_t leaf = osz_ - 1;
   int32_t node = osz_;
   for (int32_t i = osz_; i < 2 * osz_ - 1; i++) {
     int32_t mini[2] = {0};
     for (int32_t j = 0; j < 2; j++) {
-      if (leaf >= 0 && tree_[leaf].count < tree_[node].count) {
+      if (leaf >= 0 && tree[leaf].count < tree[node].count) {
         mini[j] = leaf--;
       } else {
         mini[j] = node++;
       }
     }
-    tree_[i].left = mini[0];
-    tree_[i].right = mini[1];
-    tree_[i].count = tree_[mini[0]].count + tree_[mini[1]].count;
-    tree_[mini[0]].parent = i;
-    tree_[mini[1]].parent = i;
-    tree_[mini[1]].binary = true;
+    children_[i - osz_] = Children{mini[0], mini[1]};
+    tree[i].count = tree[mini[0]].count + tree[mini[1]].count;
+    tree[mini[0]].parent = i;
+    tree[mini[1]].parent = i;
+    tree[mini[1]].binary = true;
+  }
+  if (!paths) {
+    return;
   }
+  pathOffsets_.resize(osz_ + 1);
+  pathOffsets_[0] = 0;
   for (int32_t i = 0; i < osz_; i++) {
-    std::vector<int32_t> path;
-    std::vector<bool> code;
-    int32_t j = i;
-    while (tree_[j].parent != -1) {
-      path.push_back(tree_[j].parent - osz_);
-      code.push_back(tree_[j].binary);
-      j = tree_[j].parent;
+    for (int32_t j = i; tree[j].parent != -1; j = tree[j].parent) {
+      pathNodes_.push_back(tree[j].parent - osz_);
+      pathCodes_.push_back(tree[j].binary);
     }
-    paths_.push_back(path);
-    codes_.push_back(code);
+    pathOffsets_[i + 1] = pathNodes_.size();
   }
 }
 
@@ -250,73 +340,149 @@ real HierarchicalSoftmaxLoss::forward(
     Model::State& state,
     real lr,
     bool backprop) {
+  checkTraining(!pathOffsets_.empty());
   real loss = 0.0;
   int32_t target = targets[targetIndex];
-  const std::vector<bool>& binaryCode = codes_[target];
-  const std::vector<int32_t>& pathToRoot = paths_[target];
-  for (int32_t i = 0; i < pathToRoot.size(); i++) {
-    loss += binaryLogistic(pathToRoot[i], state, binaryCode[i], lr, backprop);
+  for (int64_t i = pathOffsets_[target]; i < pathOffsets_[target + 1]; i++) {
+    loss += binaryLogistic(pathNodes_[i], state, pathCodes_[i], lr, backprop);
   }
   return loss;
 }
 
+// Best-first search: the frontier is a max-heap of the nodes to visit,
+// scored by the log-probability of their path. Scores (nearly) decrease along
+// the paths, so the leaves are reached in decreasing order and the search
+// ends as soon as the best node left is below the k-th best score.
 void HierarchicalSoftmaxLoss::predict(
     int32_t k,
     real threshold,
     Predictions& heap,
     Model::State& state) const {
-  dfs(k, threshold, 2 * osz_ - 2, 0.0, heap, state.hidden);
+  const real minScore = std_log(threshold);
+  std::pair<real, int32_t> current(0.0, 2 * osz_ - 2);
+  state.frontier.clear();
+  while (advance(k, heap, state.frontier, current)) {
+    const real dot = wo_->dotRow(state.hidden, current.second - osz_);
+    expand(dot, minScore, state.frontier, current);
+  }
   std::sort_heap(heap.begin(), heap.end(), comparePairs);
 }
 
-void HierarchicalSoftmaxLoss::dfs(
+void HierarchicalSoftmaxLoss::predict(
     int32_t k,
     real threshold,
-    int32_t node,
-    real score,
-    Predictions& heap,
-    const Vector& hidden) const {
-  if (score < std_log(threshold)) {
-    return;
+    const std::vector<int64_t>& inputs,
+    std::vector<Predictions>& heaps,
+    Model::BatchState& batch) const {
+  // The searches of the inputs go on together, one node of each at a time:
+  // the rows of the nodes of a round are independent reads, which overlap.
+  const int64_t n = inputs.size();
+  const int64_t dim = batch.hidden.cols();
+  const real minScore = std_log(threshold);
+  std::vector<std::pair<real, int32_t>> current(n);
+  std::vector<int64_t> active(n), rows(n);
+  std::vector<const real*> hidden(n);
+  std::vector<real> dots(n);
+  batch.frontiers.resize(std::max<size_t>(batch.frontiers.size(), n));
+  for (int64_t j = 0; j < n; j++) {
+    current[j] = std::make_pair(real(0.0), 2 * osz_ - 2);
+    batch.frontiers[j].clear();
+    active[j] = j;
   }
-  if (heap.size() == k && score < heap.front().first) {
-    return;
+  while (!active.empty()) {
+    int64_t m = 0;
+    for (int64_t j : active) {
+      if (advance(k, heaps[inputs[j]], batch.frontiers[j], current[j])) {
+        hidden[m] = batch.hidden.data() + inputs[j] * dim;
+        rows[m] = current[j].second - osz_;
+        active[m++] = j;
+      }
+    }
+    active.resize(m);
+    wo_->dotRowPairs(hidden.data(), rows.data(), m, dots.data());
+    for (int64_t t = 0; t < m; t++) {
+      const int64_t j = active[t];
+      expand(dots[t], minScore, batch.frontiers[j], current[j]);
+    }
+  }
+  for (int64_t i : inputs) {
+    std::sort_heap(heaps[i].begin(), heaps[i].end(), comparePairs);
   }
+}
 
-  if (tree_[node].left == -1 && tree_[node].right == -1) {
-    heap.push_back(std::make_pair(score, node));
+bool HierarchicalSoftmaxLoss::advance(
+    int32_t k,
+    Predictions& heap,
+    Predictions& frontier,
+    std::pair<real, int32_t>& current) const {
+  while (true) {
+    if (current.second < 0) {
+      if (frontier.empty()) {
+        return false;
+      }
+      std::pop_heap(frontier.begin(), frontier.end(), compareScores);
+      current = frontier.back();
+      frontier.pop_back();
+    }
+    if (heap.size() == static_cast<size_t>(k) &&
+        current.first < heap.front().first) {
+      return false;
+    }
+    if (current.second >= osz_) {
+      return true;
+    }
+    heap.push_back(current);
     std::push_heap(heap.begin(), heap.end(), comparePairs);
     if (heap.size() > k) {
       std::pop_heap(heap.begin(), heap.end(), comparePairs);
       heap.pop_back();
     }
-    return;
+    current.second = -1;
   }
+}
 
-  real f = wo_->dotRow(hidden, node - osz_);
-  f = 1. / (1 + std::exp(-f));
-
-  dfs(k, threshold, tree_[node].left, score + std_log(1.0 - f), heap, hidden);
-  dfs(k, threshold, tree_[node].right, score + std_log(f), heap, hidden);
+void HierarchicalSoftmaxLoss::expand(
+    real dot,
+    real minScore,
+    Predictions& frontier,
+    std::pair<real, int32_t>& current) const {
+  const real f = 1. / (1 + std::exp(-dot));
+  const Children& children = children_[current.second - osz_];
+  std::pair<real, int32_t> best(
+      current.first + std_log(1.0 - f), children.left);
+  std::pair<real, int32_t> other(current.first + std_log(f), children.right);
+  if (best.first < other.first) {
+    std::swap(best, other);
+  }
+  if (other.first >= minScore) {
+    frontier.push_back(other);
+    std::push_heap(frontier.begin(), frontier.end(), compareScores);
+  }
+  current.second = -1;
+  if (best.first < minScore) {
+    return;
+  }
+  // the best child is visited right away when it is at least as good as the
+  // rest of the frontier, without going through it
+  if (frontier.empty() || best.first >= frontier.front().first) {
+    current = best;
+  } else {
+    frontier.push_back(best);
+    std::push_heap(frontier.begin(), frontier.end(), compareScores);
+  }
 }
 
 SoftmaxLoss::SoftmaxLoss(std::shared_ptr<Matrix>& wo) : Loss(wo) {}
 
 void SoftmaxLoss::computeOutput(Model::State& state) const {
   Vector& output = state.output;
-  output.mul(*wo_, state.hidden);
-  real max = output[0], z = 0.0;
-  int32_t osz = output.size();
-  for (int32_t i = 0; i < osz; i++) {
-    max = std::max(output[i], max);
-  }
-  for (int32_t i = 0; i < osz; i++) {
-    output[i] = exp(output[i] - max);
-    z += output[i];
-  }
-  for (int32_t i = 0; i < osz; i++) {
-    output[i] /= z;
-  }
+  output.mul(outputMatrix(state), state.hidden);
+  activate(output.data(), output.size());
+}
+
+void SoftmaxLoss::activate(real* output, int64_t osz) const {
+  const real z = kernels::expSum(output, kernels::max(output, osz), osz);
+  kernels::scale(output, 1.0 / z, osz);
 }
 
 real SoftmaxLoss::forward(
@@ -332,12 +498,13 @@ real SoftmaxLoss::forward(
   int32_t target = targets[targetIndex];
 
   if (backprop) {
-    int32_t osz = wo_->size(0);
+    Matrix& wo = outputMatrix(state);
+    int32_t osz = wo.size(0);
     for (int32_t i = 0; i < osz; i++) {
       real label = (i == target) ? 1.0 : 0.0;
       real alpha = lr * (label - state.output[i]);
-      state.grad.addRow(*wo_, i, alpha);
-      wo_->addVectorToRow(state.hidden, i, alpha);
+      state.grad.addRow(wo, i, alpha);
+      wo.addVectorToRow(state.hidden, i, alpha);
     }
   }
   return -log(state.output[target]);
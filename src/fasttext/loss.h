@@ -26,7 +26,8 @@ class Loss {
       int32_t k,
       real threshold,
       Predictions& heap,
-      const Vector& output) const;
+      const real* output,
+      int64_t osz) const;
 
  protected:
   std::vector<real> t_sigmoid_;
@@ -35,6 +36,10 @@ class Loss {
 
   real log(real x) const;
   real sigmoid(real x) const;
+  // the output matrix of a state, its private copy if it has one
+  inline Matrix& outputMatrix(Model::State& state) const {
+    return state.localOutput ? *state.localOutput : *wo_;
+  }
 
  public:
   explicit Loss(std::shared_ptr<Matrix>& wo);
@@ -47,12 +52,36 @@ class Loss {
       real lr,
       bool backprop) = 0;
   virtual void computeOutput(Model::State& state) const = 0;
+  // turns the scores of the output matrix into the output (probabilities),
+  // in place: computeOutput is the product with the output matrix followed
+  // by activate
+  virtual void activate(real* output, int64_t osz) const = 0;
 
   virtual void predict(
       int32_t /*k*/,
       real /*threshold*/,
       Predictions& /*heap*/,
       Model::State& /*state*/) const;
+  // batched predict: heaps[i] gets the predictions of the hidden vector in
+  // row i of batch.hidden, for each i of inputs. By default, predict is
+  // called for each of them.
+  virtual void predict(
+      int32_t k,
+      real threshold,
+      const std::vector<int64_t>& inputs,
+      std::vector<Predictions>& heaps,
+      Model::BatchState& batch) const;
+  // false when predictions are not read from the whole output (and the
+  // output of several inputs can not be computed at once)
+  virtual bool predictsFromOutput() const {
+    return true;
+  }
+  void predictFromOutput(
+      int32_t k,
+      real threshold,
+      Predictions& heap,
+      const real* output,
+      int64_t osz) const;
 };
 
 class BinaryLogisticLoss : public Loss {
@@ -68,6 +97,7 @@ class BinaryLogisticLoss : public Loss {
   explicit BinaryLogisticLoss(std::shared_ptr<Matrix>& wo);
   virtual ~BinaryLogisticLoss() noexcept override = default;
   void computeOutput(Model::State& state) const override;
+  void activate(real* output, int64_t osz) const override;
 };
 
 class OneVsAllLoss : public BinaryLogisticLoss {
@@ -84,18 +114,28 @@ class OneVsAllLoss : public BinaryLogisticLoss {
 
 class NegativeSamplingLoss : public BinaryLogisticLoss {
  protected:
-  static const int32_t NEGATIVE_TABLE_SIZE = 10000000;
+  // Alias table of the distribution of the negatives (counts^0.5). A draw x
+  // of the generator below drawLimit_ picks the column x % n, which gives its
+  // own target if x / n is below its threshold, its alias otherwise: columns
+  // and thresholds come from the same draw, as consecutive draws of the
+  // generator are correlated.
+  struct AliasColumn {
+    uint32_t threshold;
+    int32_t alias;
+  };
 
   int neg_;
-  std::vector<int32_t> negatives_;
-  std::uniform_int_distribution<size_t> uniform_;
+  // empty when the loss is built for inference only
+  std::vector<AliasColumn> aliases_;
+  uint64_t drawLimit_;
   int32_t getNegative(int32_t target, std::minstd_rand& rng);
 
  public:
   explicit NegativeSamplingLoss(
       std::shared_ptr<Matrix>& wo,
       int neg,
-      const std::vector<int64_t>& targetCounts);
+      const std::vector<int64_t>& targetCounts,
+      bool training = true);
   ~NegativeSamplingLoss() noexcept override = default;
 
   real forward(
@@ -108,31 +148,44 @@ class NegativeSamplingLoss : public BinaryLogisticLoss {
 
 class HierarchicalSoftmaxLoss : public BinaryLogisticLoss {
  protected:
-  struct Node {
-    int32_t parent;
+  // children of the inner nodes, indexed like their rows of the output
+  // matrix: the only part of the tree read by the search of predict
+  struct Children {
     int32_t left;
     int32_t right;
-    int64_t count;
-    bool binary;
   };
 
-  std::vector<std::vector<int32_t>> paths_;
-  std::vector<std::vector<bool>> codes_;
-  std::vector<Node> tree_;
+  // Paths from the labels to the root, in compressed rows: the inner nodes
+  // (rows of the output matrix) of the path of label i and the side taken at
+  // each of them are in [pathOffsets_[i], pathOffsets_[i + 1]) of pathNodes_
+  // and pathCodes_. They are only used by forward, and left empty when the
+  // loss is built for inference only.
+  std::vector<int64_t> pathOffsets_;
+  std::vector<int32_t> pathNodes_;
+  std::vector<uint8_t> pathCodes_;
+  std::vector<Children> children_;
   int32_t osz_;
-  void buildTree(const std::vector<int64_t>& counts);
-  void dfs(
+  void buildTree(const std::vector<int64_t>& counts, bool paths);
+  // Steps of the best-first search of predict: advance moves the search to
+  // the next inner node to score (current), adding the leaves met on the way
+  // to the heap, and returns false when the search is over; expand goes on
+  // from current with its score.
+  bool advance(
       int32_t k,
-      real threshold,
-      int32_t node,
-      real score,
       Predictions& heap,
-      const Vector& hidden) const;
+      Predictions& frontier,
+      std::pair<real, int32_t>& current) const;
+  void expand(
+      real dot,
+      real minScore,
+      Predictions& frontier,
+      std::pair<real, int32_t>& current) const;
 
  public:
   explicit HierarchicalSoftmaxLoss(
       std::shared_ptr<Matrix>& wo,
-      const std::vector<int64_t>& counts);
+      const std::vector<int64_t>& counts,
+      bool training = true);
   ~HierarchicalSoftmaxLoss() noexcept override = default;
   real forward(
       const std::vector<int32_t>& targets,
@@ -145,6 +198,15 @@ class HierarchicalSoftmaxLoss : public BinaryLogisticLoss {
       real threshold,
       Predictions& heap,
       Model::State& state) const override;
+  void predict(
+      int32_t k,
+      real threshold,
+      const std::vector<int64_t>& inputs,
+      std::vector<Predictions>& heaps,
+      Model::BatchState& batch) const override;
+  bool predictsFromOutput() const override {
+    return false;
+  }
 };
 
 class SoftmaxLoss : public Loss {
@@ -158,6 +220,7 @@ class SoftmaxLoss : public Loss {
       real lr,
       bool backprop) override;
   void computeOutput(Model::State& state) const override;
+  void activate(real* output, int64_t osz) const override;
 };
 
 } // namespace fasttext
@@ -43,11 +43,12 @@ void printQuantizeUsage() {
 
 void printTestUsage() {
   std::cerr
-      << "usage: fasttext test <model> <test-data> [<k>] [<th>]\n\n"
+      << "usage: fasttext test <model> <test-data> [<k>] [<th>] [<thread>]\n\n"
       << "  <model>      model filename\n"
       << "  <test-data>  test data filename (if -, read from stdin)\n"
       << "  <k>          (optional; 1 by default) predict top k labels\n"
       << "  <th>         (optional; 0.0 by default) probability threshold\n"
+      << "  <thread>     (optional; 1 by default) number of threads, not used with stdin\n"
       << std::endl;
 }
 
@@ -63,11 +64,12 @@ void printPredictUsage() {
 
 void printTestLabelUsage() {
   std::cerr
-      << "usage: fasttext test-label <model> <test-data> [<k>] [<th>]\n\n"
+      << "usage: fasttext test-label <model> <test-data> [<k>] [<th>] [<thread>]\n\n"
       << "  <model>      model filename\n"
       << "  <test-data>  test data filename\n"
       << "  <k>          (optional; 1 by default) predict top k labels\n"
       << "  <th>         (optional; 0.0 by default) probability threshold\n"
+      << "  <thread>     (optional; 1 by default) number of threads\n"
       << std::endl;
 }
 
@@ -129,7 +131,7 @@ void printDumpUsage() {
 void test(const std::vector<std::string>& args) {
   bool perLabel = args[1] == "test-label";
 
-  if (args.size() < 4 || args.size() > 6) {
+  if (args.size() < 4 || args.size() > 7) {
     perLabel ? printTestLabelUsage() : printTestUsage();
     exit(EXIT_FAILURE);
   }
@@ -138,21 +140,21 @@ void test(const std::vector<std::string>& args) {
   const auto& input = args[3];
   int32_t k = args.size() > 4 ? std::stoi(args[4]) : 1;
   real threshold = args.size() > 5 ? std::stof(args[5]) : 0.0;
+  int32_t nthreads = args.size() > 6 ? std::stoi(args[6]) : 1;
 
   FastText fasttext;
-  fasttext.loadModel(model);
+  fasttext.loadModel(model, false, true);
 
   Meter meter;
 
   if (input == "-") {
     fasttext.test(std::cin, k, threshold, meter);
   } else {
-    std::ifstream ifs(input);
-    if (!ifs.is_open()) {
+    if (!std::ifstream(input).is_open()) {
       std::cerr << "Test file cannot be opened!" << std::endl;
       exit(EXIT_FAILURE);
     }
-    fasttext.test(ifs, k, threshold, meter);
+    fasttext.test(input, k, threshold, meter, nthreads);
   }
 
   if (perLabel) {
@@ -219,7 +221,7 @@ void predict(const std::vector<std::string>& args) {
 
   bool printProb = args[1] == "predict-prob";
   FastText fasttext;
-  fasttext.loadModel(std::string(args[2]));
+  fasttext.loadModel(std::string(args[2]), false, true);
 
   std::ifstream ifs;
   std::string infile(args[3]);
@@ -249,7 +251,7 @@ void printWordVectors(const std::vector<std::string> args) {
     exit(EXIT_FAILURE);
   }
   FastText fasttext;
-  fasttext.loadModel(std::string(args[2]));
+  fasttext.loadModel(std::string(args[2]), false, true);
   std::string word;
   Vector vec(fasttext.getDimension());
   while (std::cin >> word) {
@@ -265,7 +267,7 @@ void printSentenceVectors(const std::vector<std::string> args) {
     exit(EXIT_FAILURE);
   }
   FastText fasttext;
-  fasttext.loadModel(std::string(args[2]));
+  fasttext.loadModel(std::string(args[2]), false, true);
   Vector svec(fasttext.getDimension());
   while (std::cin.peek() != EOF) {
     fasttext.getSentenceVector(std::cin, svec);
@@ -281,7 +283,7 @@ void printNgrams(const std::vector<std::string> args) {
     exit(EXIT_FAILURE);
   }
   FastText fasttext;
-  fasttext.loadModel(std::string(args[2]));
+  fasttext.loadModel(std::string(args[2]), false, true);
 
   std::string word(args[3]);
   std::vector<std::pair<std::string, Vector>> ngramVectors =
@@ -305,7 +307,7 @@ void nn(const std::vector<std::string> args) {
     exit(EXIT_FAILURE);
   }
   FastText fasttext;
-  fasttext.loadModel(std::string(args[2]));
+  fasttext.loadModel(std::string(args[2]), false, true);
   std::string prompt("Query word? ");
   std::cout << prompt;
 
@@ -333,7 +335,7 @@ void analogies(const std::vector<std::string> args) {
   FastText fasttext;
   std::string model(args[2]);
   std::cout << "Loading model " << model << std::endl;
-  fasttext.loadModel(model);
+  fasttext.loadModel(model, false, true);
 
   std::string prompt("Query triplet (A - B + C)? ");
   std::string wordA, wordB, wordC;
@@ -374,7 +376,10 @@ void train(const std::vector<std::string> args) {
     fasttext->train(a);
   }
   fasttext->saveModel(outputFileName);
-  fasttext->saveVectors(a.output + ".vec");
+  fasttext->saveVectors(
+      a.output + (a.binaryVectors ? ".vecb" : ".vec"),
+      a.binaryVectors,
+      a.thread);
   if (a.saveOutput) {
     fasttext->saveOutput(a.output + ".output");
   }
@@ -390,7 +395,7 @@ void dump(const std::vector<std::string>& args) {
   std::string option = args[3];
 
   FastText fasttext;
-  fasttext.loadModel(modelPath);
+  fasttext.loadModel(modelPath, false, true);
   if (option == "args") {
     fasttext.getArgs().dump(std::cout);
   } else if (option == "dict") {
@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "mappedfile.h"
+
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fasttext {
+
+#ifndef _WIN32
+
+MappedFile::MappedFile(const std::string& filename)
+    : data_(nullptr), size_(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::invalid_argument(filename + " cannot be opened for mapping!");
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::invalid_argument(filename + " cannot be opened for mapping!");
+  }
+  size_ = st.st_size;
+  if (size_ > 0) {
+    void* addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error(filename + " cannot be mapped in memory!");
+    }
+    data_ = static_cast<const char*>(addr);
+  }
+  // the mapping stays valid after the descriptor is closed
+  close(fd);
+}
+
+MappedFile::~MappedFile() noexcept {
+  if (data_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+}
+
+bool MappedFile::isSupported() {
+  return true;
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filename)
+    : data_(nullptr), size_(0) {
+  throw std::runtime_error(
+      filename + " cannot be mapped: not supported on this platform!");
+}
+
+MappedFile::~MappedFile() noexcept {}
+
+bool MappedFile::isSupported() {
+  return false;
+}
+
+#endif
+
+} // namespace fasttext
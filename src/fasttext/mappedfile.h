@@ -0,0 +1,41 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace fasttext {
+
+// Read-only memory mapping of a whole file. Pages are loaded lazily and are
+// shared with every other process mapping the same file.
+class MappedFile {
+ protected:
+  const char* data_;
+  int64_t size_;
+
+ public:
+  explicit MappedFile(const std::string& filename);
+  MappedFile(const MappedFile&) = delete;
+  MappedFile(MappedFile&&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile& operator=(MappedFile&&) = delete;
+  ~MappedFile() noexcept;
+
+  inline const char* data() const {
+    return data_;
+  }
+  inline int64_t size() const {
+    return size_;
+  }
+
+  static bool isSupported();
+};
+
+} // namespace fasttext
@@ -0,0 +1,152 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "mappedmatrix.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "densematrix.h"
+#include "kernels.h"
+#include "vector.h"
+
+namespace fasttext {
+
+MappedMatrix::MappedMatrix(std::shared_ptr<const MappedFile> file)
+    : Matrix(), file_(file), data_(nullptr), aligned_(false) {}
+
+namespace {
+
+// buffer of the rows copied out of unaligned matrices, one per thread so that
+// dotRow and addRowToVector do not allocate
+real* scratchRow(int64_t n) {
+  thread_local std::vector<real> scratch;
+  if (scratch.size() < static_cast<size_t>(n)) {
+    scratch.resize(n);
+  }
+  return scratch.data();
+}
+
+} // namespace
+
+real MappedMatrix::dotRow(const Vector& vec, int64_t i) const {
+  assert(i >= 0);
+  assert(i < m_);
+  assert(vec.size() == n_);
+  real d = kernels::dot(row(i, scratchRow(n_)), vec.data(), n_);
+  if (std::isnan(d)) {
+    throw DenseMatrix::EncounteredNaNError();
+  }
+  return d;
+}
+
+void MappedMatrix::dotRows(const Vector& vec, Vector& out) const {
+  assert(vec.size() == n_);
+  assert(out.size() == m_);
+  real* scratch = scratchRow(n_);
+  for (int64_t i = 0; i < m_; i++) {
+    out[i] = kernels::dot(row(i, scratch), vec.data(), n_);
+  }
+  if (kernels::hasNaN(out.data(), m_)) {
+    throw DenseMatrix::EncounteredNaNError();
+  }
+}
+
+void MappedMatrix::dotRows(const real* x, int64_t m, real* out) const {
+  if (aligned_) {
+    kernels::gemm(
+        x, reinterpret_cast<const real*>(data_), out, m, m_, n_, m_);
+    if (kernels::hasNaN(out, m * m_)) {
+      throw DenseMatrix::EncounteredNaNError();
+    }
+    return;
+  }
+  // rows are copied by tiles, each multiplied by all the vectors of x
+  const int64_t tileRows = 256;
+  std::vector<real> tile(tileRows * n_);
+  for (int64_t j = 0; j < m_; j += tileRows) {
+    const int64_t rows = std::min(tileRows, m_ - j);
+    std::memcpy(
+        tile.data(), data_ + j * n_ * sizeof(real), rows * n_ * sizeof(real));
+    kernels::gemm(x, tile.data(), out + j, m, rows, n_, m_);
+  }
+  if (kernels::hasNaN(out, m * m_)) {
+    throw DenseMatrix::EncounteredNaNError();
+  }
+}
+
+void MappedMatrix::dotRowPairs(
+    const real* const* x,
+    const int64_t* rows,
+    int64_t n,
+    real* out) const {
+  real* scratch = scratchRow(n_);
+  for (int64_t i = 0; i < n; i++) {
+    assert(rows[i] >= 0 && rows[i] < m_);
+    out[i] = kernels::dot(row(rows[i], scratch), x[i], n_);
+  }
+  if (kernels::hasNaN(out, n)) {
+    throw DenseMatrix::EncounteredNaNError();
+  }
+}
+
+void MappedMatrix::addVectorToRow(const Vector&, int64_t, real) {
+  throw std::runtime_error(
+      "Operation not permitted on memory mapped matrices.");
+}
+
+void MappedMatrix::addRowToVector(Vector& x, int32_t i) const {
+  assert(i >= 0);
+  assert(i < this->size(0));
+  assert(x.size() == this->size(1));
+  kernels::add(x.data(), row(i, scratchRow(n_)), n_);
+}
+
+void MappedMatrix::addRowToVector(Vector& x, int32_t i, real a) const {
+  assert(i >= 0);
+  assert(i < this->size(0));
+  assert(x.size() == this->size(1));
+  kernels::addScaled(x.data(), row(i, scratchRow(n_)), a, n_);
+}
+
+void MappedMatrix::save(std::ostream& out) const {
+  out.write((char*)&m_, sizeof(int64_t));
+  out.write((char*)&n_, sizeof(int64_t));
+  out.write(data_, m_ * n_ * sizeof(real));
+}
+
+void MappedMatrix::load(std::istream& in) {
+  in.read((char*)&m_, sizeof(int64_t));
+  in.read((char*)&n_, sizeof(int64_t));
+  const int64_t offset = in.tellg();
+  const int64_t bytes = m_ * n_ * sizeof(real);
+  if (!in || m_ < 0 || n_ < 0 || offset + bytes > file_->size()) {
+    throw std::invalid_argument("Model file is truncated.");
+  }
+  data_ = file_->data() + offset;
+  aligned_ = reinterpret_cast<uintptr_t>(data_) % alignof(real) == 0;
+  in.seekg(bytes, std::ios_base::cur);
+}
+
+void MappedMatrix::dump(std::ostream& out) const {
+  out << m_ << " " << n_ << std::endl;
+  for (int64_t i = 0; i < m_; i++) {
+    for (int64_t j = 0; j < n_; j++) {
+      if (j > 0) {
+        out << " ";
+      }
+      out << at(i, j);
+    }
+    out << std::endl;
+  }
+}
+
+} // namespace fasttext
@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <ostream>
+
+#include "mappedfile.h"
+#include "matrix.h"
+#include "real.h"
+
+namespace fasttext {
+
+// Dense matrix whose rows are read in place from a memory mapped model file.
+// Rows are stored at whatever offset the model format puts them, which is
+// not necessarily aligned for real: rows are then copied out with memcpy
+// before being read. The matrix is read-only.
+class MappedMatrix : public Matrix {
+ protected:
+  std::shared_ptr<const MappedFile> file_;
+  const char* data_;
+  // whether the rows can be read in place (all rows have the alignment of
+  // the first one)
+  bool aligned_;
+
+  inline real at(int64_t i, int64_t j) const {
+    real value;
+    std::memcpy(&value, data_ + (i * n_ + j) * sizeof(real), sizeof(real));
+    return value;
+  }
+  // row i, in place when the rows are aligned, copied to scratch (n_ values)
+  // otherwise
+  inline const real* row(int64_t i, real* scratch) const {
+    const char* begin = data_ + i * n_ * sizeof(real);
+    if (aligned_) {
+      return reinterpret_cast<const real*>(begin);
+    }
+    std::memcpy(scratch, begin, n_ * sizeof(real));
+    return scratch;
+  }
+
+ public:
+  explicit MappedMatrix(std::shared_ptr<const MappedFile> file);
+  MappedMatrix(const MappedMatrix&) = delete;
+  MappedMatrix(MappedMatrix&&) = delete;
+  MappedMatrix& operator=(const MappedMatrix&) = delete;
+  MappedMatrix& operator=(MappedMatrix&&) = delete;
+  virtual ~MappedMatrix() noexcept override = default;
+
+  real dotRow(const Vector&, int64_t) const override;
+  void dotRows(const Vector&, Vector& out) const override;
+  void dotRows(const real* x, int64_t m, real* out) const override;
+  void dotRowPairs(
+      const real* const* x,
+      const int64_t* rows,
+      int64_t n,
+      real* out) const override;
+  void addVectorToRow(const Vector&, int64_t, real) override;
+  void addRowToVector(Vector& x, int32_t i) const override;
+  void addRowToVector(Vector& x, int32_t i, real a) const override;
+  void save(std::ostream&) const override;
+  void load(std::istream&) override;
+  void dump(std::ostream&) const override;
+};
+
+} // namespace fasttext
@@ -8,6 +8,10 @@
 
 #include "matrix.h"
 
+#include <algorithm>
+
+#include "vector.h"
+
 namespace fasttext {
 
 Matrix::Matrix() : m_(0), n_(0) {}
@@ -22,4 +26,32 @@ int64_t Matrix::size(int64_t dim) const {
   return n_;
 }
 
+void Matrix::dotRows(const Vector& vec, Vector& out) const {
+  assert(out.size() == m_);
+  for (int64_t i = 0; i < m_; i++) {
+    out[i] = dotRow(vec, i);
+  }
+}
+
+void Matrix::dotRows(const real* x, int64_t m, real* out) const {
+  Vector vec(n_), dots(m_);
+  for (int64_t i = 0; i < m; i++) {
+    std::copy(x + i * n_, x + (i + 1) * n_, vec.data());
+    dotRows(vec, dots);
+    std::copy(dots.data(), dots.data() + m_, out + i * m_);
+  }
+}
+
+void Matrix::dotRowPairs(
+    const real* const* x,
+    const int64_t* rows,
+    int64_t n,
+    real* out) const {
+  Vector vec(n_);
+  for (int64_t i = 0; i < n; i++) {
+    std::copy(x[i], x[i] + n_, vec.data());
+    out[i] = dotRow(vec, rows[i]);
+  }
+}
+
 } // namespace fasttext
@@ -33,6 +33,17 @@ class Matrix {
   int64_t size(int64_t dim) const;
 
   virtual real dotRow(const Vector&, int64_t) const = 0;
+  virtual void dotRows(const Vector&, Vector& out) const;
+  // batched dotRows for the m vectors stored one after the other in x:
+  // out[i * size(0) + j] is the dot product of row j with the i-th vector
+  virtual void dotRows(const real* x, int64_t m, real* out) const;
+  // out[i] is the dot product of row rows[i] with the vector x[i], for n
+  // (vector, row) pairs which are independent: their rows are read together
+  virtual void dotRowPairs(
+      const real* const* x,
+      const int64_t* rows,
+      int64_t n,
+      real* out) const;
   virtual void addVectorToRow(const Vector&, int64_t, real) = 0;
   virtual void addRowToVector(Vector& x, int32_t i) const = 0;
   virtual void addRowToVector(Vector& x, int32_t i, real a) const = 0;
@@ -41,6 +41,23 @@ void Meter::log(
   }
 }
 
+void Meter::merge(const Meter& other) {
+  nexamples_ += other.nexamples_;
+  metrics_.gold += other.metrics_.gold;
+  metrics_.predicted += other.metrics_.predicted;
+  metrics_.predictedGold += other.metrics_.predictedGold;
+  for (const auto& it : other.labelMetrics_) {
+    Metrics& metrics = labelMetrics_[it.first];
+    metrics.gold += it.second.gold;
+    metrics.predicted += it.second.predicted;
+    metrics.predictedGold += it.second.predictedGold;
+    metrics.scoreVsTrue.insert(
+        metrics.scoreVsTrue.end(),
+        it.second.scoreVsTrue.begin(),
+        it.second.scoreVsTrue.end());
+  }
+}
+
 double Meter::precision(int32_t i) {
   return labelMetrics_[i].precision();
 }
@@ -50,6 +50,9 @@ class Meter {
   Meter() : metrics_(), nexamples_(0), labelMetrics_() {}
 
   void log(const std::vector<int32_t>& labels, const Predictions& predictions);
+  // adds the examples logged by another meter, as if they had been logged
+  // by this one after its own
+  void merge(const Meter& other);
 
   double precision(int32_t);
   double recall(int32_t);
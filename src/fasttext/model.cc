@@ -7,10 +7,13 @@
  */
 
 #include "model.h"
+#include "kernels.h"
 #include "loss.h"
 #include "utils.h"
 
+#include <assert.h>
 #include <algorithm>
+#include <cmath>
 #include <stdexcept>
 
 namespace fasttext {
@@ -32,6 +35,14 @@ void Model::State::incrementNExamples(real loss) {
   nexamples_++;
 }
 
+Model::BatchState::BatchState(
+    int64_t batchSize,
+    int32_t hiddenSize,
+    int32_t outputSize)
+    : hidden(batchSize, hiddenSize),
+      output(batchSize, outputSize),
+      state(hiddenSize, outputSize, 0) {}
+
 Model::Model(
     std::shared_ptr<Matrix> wi,
     std::shared_ptr<Matrix> wo,
@@ -39,6 +50,30 @@ Model::Model(
     bool normalizeGradient)
     : wi_(wi), wo_(wo), loss_(loss), normalizeGradient_(normalizeGradient) {}
 
+void Model::setLocalOutput(State& state) const {
+  const DenseMatrix* wo = dynamic_cast<const DenseMatrix*>(wo_.get());
+  if (!wo) {
+    throw std::invalid_argument(
+        "Only a dense output matrix can be copied for each thread.");
+  }
+  state.localOutput.reset(new DenseMatrix(*wo));
+  state.syncedOutput.reset(new DenseMatrix(*wo));
+}
+
+void Model::syncOutput(State& state) const {
+  assert(state.localOutput);
+  real* shared = static_cast<DenseMatrix&>(*wo_).data();
+  real* local = state.localOutput->data();
+  real* synced = state.syncedOutput->data();
+  const int64_t n = wo_->size(0) * wo_->size(1);
+  for (int64_t i = 0; i < n; i++) {
+    real value = shared[i] + (local[i] - synced[i]);
+    shared[i] = value;
+    local[i] = value;
+    synced[i] = value;
+  }
+}
+
 void Model::computeHidden(const std::vector<int32_t>& input, State& state)
     const {
   Vector& hidden = state.hidden;
@@ -66,6 +101,92 @@ void Model::predict(
   loss_->predict(k, threshold, heap, state);
 }
 
+void Model::computeHidden(
+    const std::vector<std::vector<int32_t>>& inputs,
+    BatchState& batch,
+    std::vector<int64_t>& nonEmpty) const {
+  const int64_t n = inputs.size();
+  const int64_t dim = batch.hidden.cols();
+  assert(n <= batch.size());
+  nonEmpty.clear();
+  for (int64_t i = 0; i < n; i++) {
+    real* hidden = batch.hidden.data() + i * dim;
+    if (inputs[i].empty()) {
+      std::fill(hidden, hidden + dim, 0.0);
+      continue;
+    }
+    computeHidden(inputs[i], batch.state);
+    std::copy(
+        batch.state.hidden.data(), batch.state.hidden.data() + dim, hidden);
+    nonEmpty.push_back(i);
+  }
+}
+
+void Model::computeOutput(
+    const std::vector<std::vector<int32_t>>& inputs,
+    BatchState& batch) const {
+  const int64_t n = inputs.size();
+  const int64_t osz = batch.output.cols();
+  std::vector<int64_t> nonEmpty;
+  computeHidden(inputs, batch, nonEmpty);
+  if (!loss_->predictsFromOutput()) {
+    // the output is the probability of each label to be predicted
+    std::vector<Predictions> heaps(n);
+    loss_->predict(osz, 0.0, nonEmpty, heaps, batch);
+    batch.output.zero();
+    for (int64_t i : nonEmpty) {
+      for (const auto& p : heaps[i]) {
+        batch.output.at(i, p.second) = std::exp(p.first);
+      }
+    }
+    return;
+  }
+  wo_->dotRows(batch.hidden.data(), n, batch.output.data());
+  for (int64_t i = 0; i < n; i++) {
+    real* output = batch.output.data() + i * osz;
+    if (inputs[i].empty()) {
+      std::fill(output, output + osz, 0.0);
+    } else {
+      loss_->activate(output, osz);
+    }
+  }
+}
+
+void Model::predict(
+    const std::vector<std::vector<int32_t>>& inputs,
+    int32_t k,
+    real threshold,
+    std::vector<Predictions>& heaps,
+    BatchState& batch) const {
+  if (k == Model::kUnlimitedPredictions) {
+    k = wo_->size(0); // output size
+  } else if (k <= 0) {
+    throw std::invalid_argument("k needs to be 1 or higher!");
+  }
+  heaps.resize(inputs.size());
+  for (auto& heap : heaps) {
+    heap.clear();
+  }
+  if (!loss_->predictsFromOutput()) {
+    std::vector<int64_t> nonEmpty;
+    computeHidden(inputs, batch, nonEmpty);
+    for (int64_t i : nonEmpty) {
+      heaps[i].reserve(k + 1);
+    }
+    loss_->predict(k, threshold, nonEmpty, heaps, batch);
+    return;
+  }
+  computeOutput(inputs, batch);
+  const int64_t osz = batch.output.cols();
+  for (size_t i = 0; i < inputs.size(); i++) {
+    if (!inputs[i].empty()) {
+      heaps[i].reserve(k + 1);
+      loss_->predictFromOutput(
+          k, threshold, heaps[i], batch.output.data() + i * osz, osz);
+    }
+  }
+}
+
 void Model::update(
     const std::vector<int32_t>& input,
     const std::vector<int32_t>& targets,
@@ -90,6 +211,124 @@ void Model::update(
   }
 }
 
+void Model::update(
+    const std::vector<int32_t>& input,
+    const std::vector<int32_t>& targets,
+    const std::vector<int32_t>& targetIndices,
+    real lr,
+    State& state) {
+  if (input.size() == 0 || targetIndices.empty()) {
+    return;
+  }
+  computeHidden(input, state);
+
+  Vector& grad = state.grad;
+  grad.zero();
+  for (int32_t targetIndex : targetIndices) {
+    real lossValue = loss_->forward(targets, targetIndex, state, lr, true);
+    state.incrementNExamples(lossValue);
+  }
+
+  if (normalizeGradient_) {
+    grad.mul(1.0 / input.size());
+  }
+  for (auto it = input.cbegin(); it != input.cend(); ++it) {
+    wi_->addVectorToRow(grad, *it, 1.0);
+  }
+}
+
+void Model::updateWindows(
+    const std::vector<const std::vector<int32_t>*>& inputs,
+    const std::vector<int32_t>& line,
+    const std::vector<int32_t>& boundaries,
+    real lr,
+    State& state) {
+  // With total the sum of the gradients of the line so far, the current sum
+  // of the rows of a word p of the window is sums[p] + |p| (total - starts[p])
+  // and the sum over the window is entered + count * total - weighted, where
+  // entered and weighted are the sums of sums[p] and |p| starts[p] over the
+  // window, and count the number of rows of the window.
+  const int64_t n = line.size();
+  const int64_t dim = wi_->size(1);
+  state.window.assign((2 * n + 3) * dim, 0.0);
+  real* sums = state.window.data();
+  real* starts = sums + n * dim;
+  real* total = starts + n * dim;
+  real* entered = total + dim;
+  real* weighted = entered + dim;
+  Vector& hidden = state.hidden;
+  Vector& grad = state.grad;
+  int64_t count = 0;
+
+  auto enter = [&](int64_t p) {
+    const std::vector<int32_t>& input = *inputs[p];
+    hidden.zero();
+    for (int32_t row : input) {
+      hidden.addRow(*wi_, row);
+    }
+    std::copy(hidden.data(), hidden.data() + dim, sums + p * dim);
+    std::copy(total, total + dim, starts + p * dim);
+    kernels::add(entered, sums + p * dim, dim);
+    kernels::addScaled(weighted, total, input.size(), dim);
+    count += input.size();
+  };
+  auto leave = [&](int64_t p) {
+    const std::vector<int32_t>& input = *inputs[p];
+    for (int64_t i = 0; i < dim; i++) {
+      hidden[i] = total[i] - starts[p * dim + i];
+    }
+    for (int32_t row : input) {
+      wi_->addVectorToRow(hidden, row, 1.0);
+    }
+    kernels::addScaled(entered, sums + p * dim, -1.0, dim);
+    kernels::addScaled(weighted, starts + p * dim, -real(input.size()), dim);
+    count -= input.size();
+  };
+
+  int64_t begin = 0, end = 0;
+  for (int64_t w = 0; w < n; w++) {
+    const int64_t first = std::max<int64_t>(0, w - boundaries[w]);
+    const int64_t last = std::min<int64_t>(n, w + boundaries[w] + 1);
+    for (; begin < std::min(first, end); begin++) {
+      leave(begin);
+    }
+    for (; end > std::max(last, begin); end--) {
+      leave(end - 1);
+    }
+    if (begin == end) {
+      begin = end = first;
+    }
+    for (; begin > first; begin--) {
+      enter(begin - 1);
+    }
+    for (; end < last; end++) {
+      enter(end);
+    }
+    const int64_t size = inputs[w]->size();
+    if (count == size) {
+      // no context
+      continue;
+    }
+    const real* sum = sums + w * dim;
+    const real* start = starts + w * dim;
+    for (int64_t i = 0; i < dim; i++) {
+      const real window = entered[i] + count * total[i] - weighted[i];
+      const real word = sum[i] + size * (total[i] - start[i]);
+      hidden[i] = (window - word) / (count - size);
+    }
+    grad.zero();
+    real lossValue = loss_->forward(line, w, state, lr, true);
+    state.incrementNExamples(lossValue);
+    // the word itself does not get the gradient
+    kernels::add(total, grad.data(), dim);
+    kernels::add(starts + w * dim, grad.data(), dim);
+    kernels::addScaled(weighted, grad.data(), size, dim);
+  }
+  for (; begin < end; begin++) {
+    leave(begin);
+  }
+}
+
 real Model::std_log(real x) const {
   return std::log(x + 1e-5);
 }
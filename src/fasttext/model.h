@@ -13,6 +13,7 @@
 #include <utility>
 #include <vector>
 
+#include "densematrix.h"
 #include "matrix.h"
 #include "real.h"
 #include "utils.h"
@@ -50,12 +51,44 @@ class Model {
     Vector output;
     Vector grad;
     std::minstd_rand rng;
+    // nodes left to visit by the search of the hierarchical softmax
+    Predictions frontier;
+    // buffers of the training of a line (FastText::cbow and skipgram), kept
+    // from one line to the next
+    std::vector<int32_t> bow;
+    std::vector<int32_t> boundaries;
+    std::vector<const std::vector<int32_t>*> inputs;
+    // buffers of updateWindows: for each position of the line, the sum of
+    // its input rows and the total gradient when it entered the window,
+    // followed by the total gradient of the line, and the sums over the
+    // window of the sums and of the (weighted) total gradients at entry
+    std::vector<real> window;
+    // when set, private copy of the output matrix which is read and updated
+    // instead of the shared one, and its value at the last syncOutput
+    std::unique_ptr<DenseMatrix> localOutput;
+    std::unique_ptr<DenseMatrix> syncedOutput;
 
     State(int32_t hiddenSize, int32_t outputSize, int32_t seed);
     real getLoss() const;
     void incrementNExamples(real loss);
   };
 
+  // Buffers of the batched inference: the hidden vectors and the outputs of
+  // a block of inputs are the rows of two matrices.
+  class BatchState {
+   public:
+    DenseMatrix hidden;
+    DenseMatrix output;
+    State state;
+    // search frontiers of the inputs (hierarchical softmax)
+    std::vector<Predictions> frontiers;
+
+    BatchState(int64_t batchSize, int32_t hiddenSize, int32_t outputSize);
+    inline int64_t size() const {
+      return hidden.rows();
+    }
+  };
+
   void predict(
       const std::vector<int32_t>& input,
       int32_t k,
@@ -68,7 +101,57 @@ class Model {
       int32_t targetIndex,
       real lr,
       State& state);
+  // update for several targets of the same input (the context of a word in
+  // skipgram): the hidden vector is computed once, and the gradients of all
+  // the targets are added up before updating the rows of the input
+  void update(
+      const std::vector<int32_t>& input,
+      const std::vector<int32_t>& targets,
+      const std::vector<int32_t>& targetIndices,
+      real lr,
+      State& state);
+  // CBOW update of each word of a line from its context, the window of
+  // position w being [w - boundaries[w], w + boundaries[w]] without w, and
+  // inputs[w] the input rows of the word at w. The sum of the window is kept
+  // as it slides: the rows of a word are summed when it enters the window,
+  // and its gradients are added to them when it leaves it (rows shared by
+  // several words of a window get them as if they were distinct).
+  void updateWindows(
+      const std::vector<const std::vector<int32_t>*>& inputs,
+      const std::vector<int32_t>& line,
+      const std::vector<int32_t>& boundaries,
+      real lr,
+      State& state);
   void computeHidden(const std::vector<int32_t>& input, State& state) const;
+  // row i of batch.hidden gets the hidden vector of inputs[i] (zeros for an
+  // empty input), the indices of the inputs which are not empty are put in
+  // nonEmpty
+  void computeHidden(
+      const std::vector<std::vector<int32_t>>& inputs,
+      BatchState& batch,
+      std::vector<int64_t>& nonEmpty) const;
+  // Gives the state a private copy of the output matrix: the updates made
+  // with this state do not touch the shared matrix (nor its cache lines)
+  // until syncOutput.
+  void setLocalOutput(State& state) const;
+  // Adds the changes of the private copy since the last sync to the shared
+  // output matrix (without lock, like the updates of hogwild), then
+  // refreshes the copy.
+  void syncOutput(State& state) const;
+
+  // Row i of batch.output gets the output (probabilities) of inputs[i], the
+  // hidden vectors being multiplied by the output matrix in a single pass.
+  // Empty inputs get a row of zeros. There are at most batch.size() inputs.
+  void computeOutput(
+      const std::vector<std::vector<int32_t>>& inputs,
+      BatchState& batch) const;
+  // predict for each of the inputs, heaps of empty inputs are left empty
+  void predict(
+      const std::vector<std::vector<int32_t>>& inputs,
+      int32_t k,
+      real threshold,
+      std::vector<Predictions>& heaps,
+      BatchState& batch) const;
 
   real std_log(real) const;
 
@@ -7,6 +7,8 @@
  */
 
 #include "productquantizer.h"
+#include "kernels.h"
+#include "utils.h"
 
 #include <algorithm>
 #include <iostream>
@@ -16,6 +18,19 @@
 
 namespace fasttext {
 
+namespace {
+
+// column j of ct is the centroid j: ct[i * ksub + j] = c[j * d + i]
+void transposeCentroids(const real* c, int32_t ksub, int32_t d, real* ct) {
+  for (auto j = 0; j < ksub; j++) {
+    for (auto i = 0; i < d; i++) {
+      ct[i * ksub + j] = c[j * d + i];
+    }
+  }
+}
+
+} // namespace
+
 real distL2(const real* x, const real* y, int32_t d) {
   real dist = 0;
   for (auto i = 0; i < d; i++) {
@@ -53,6 +68,19 @@ real* ProductQuantizer::get_centroids(int32_t m, uint8_t i) {
   return &centroids_[(m * ksub_ + i) * dsub_];
 }
 
+const real* ProductQuantizer::get_tcentroids(int32_t m) const {
+  return &tcentroids_[m * ksub_ * dsub_];
+}
+
+void ProductQuantizer::transpose_centroids() {
+  tcentroids_.resize(centroids_.size());
+  for (auto m = 0; m < nsubq_; m++) {
+    auto d = (m == nsubq_ - 1) ? lastdsub_ : dsub_;
+    transposeCentroids(
+        get_centroids(m, 0), ksub_, d, &tcentroids_[m * ksub_ * dsub_]);
+  }
+}
+
 real ProductQuantizer::assign_centroid(
     const real* x,
     const real* c0,
@@ -77,10 +105,15 @@ void ProductQuantizer::Estep(
     const real* centroids,
     uint8_t* codes,
     int32_t d,
-    int32_t n) const {
-  for (auto i = 0; i < n; i++) {
-    assign_centroid(x + i * d, centroids, codes + i, d);
-  }
+    int32_t n,
+    int32_t nthreads) const {
+  std::vector<real> ct(ksub_ * d);
+  transposeCentroids(centroids, ksub_, d, ct.data());
+  utils::parallelFor(n, nthreads, [&](int64_t begin, int64_t end) {
+    for (auto i = begin; i < end; i++) {
+      codes[i] = (uint8_t)kernels::nearestL2(x + i * d, ct.data(), ksub_, d);
+    }
+  });
 }
 
 void ProductQuantizer::MStep(
@@ -132,7 +165,12 @@ void ProductQuantizer::MStep(
   }
 }
 
-void ProductQuantizer::kmeans(const real* x, real* c, int32_t n, int32_t d) {
+void ProductQuantizer::kmeans(
+    const real* x,
+    real* c,
+    int32_t n,
+    int32_t d,
+    int32_t nthreads) {
   std::vector<int32_t> perm(n, 0);
   std::iota(perm.begin(), perm.end(), 0);
   std::shuffle(perm.begin(), perm.end(), rng);
@@ -141,12 +179,12 @@ void ProductQuantizer::kmeans(const real* x, real* c, int32_t n, int32_t d) {
   }
   auto codes = std::vector<uint8_t>(n);
   for (auto i = 0; i < niter_; i++) {
-    Estep(x, c, codes.data(), d, n);
+    Estep(x, c, codes.data(), d, n, nthreads);
     MStep(x, c, codes.data(), d, n);
   }
 }
 
-void ProductQuantizer::train(int32_t n, const real* x) {
+void ProductQuantizer::train(int32_t n, const real* x, int32_t nthreads) {
   if (n < ksub_) {
     throw std::invalid_argument(
         "Matrix too small for quantization, must have at least " +
@@ -170,8 +208,9 @@ void ProductQuantizer::train(int32_t n, const real* x) {
           x + perm[j] * dim_ + m * dsub_,
           d * sizeof(real));
     }
-    kmeans(xslice.data(), get_centroids(m, 0), np, d);
+    kmeans(xslice.data(), get_centroids(m, 0), np, d, nthreads);
   }
+  transpose_centroids();
 }
 
 real ProductQuantizer::mulcode(
@@ -194,6 +233,51 @@ real ProductQuantizer::mulcode(
   return res * alpha;
 }
 
+int64_t ProductQuantizer::table_size() const {
+  return int64_t(nsubq_) * ksub_;
+}
+
+void ProductQuantizer::compute_table(const real* x, real* table) const {
+  for (auto m = 0; m < nsubq_; m++) {
+    auto d = (m == nsubq_ - 1) ? lastdsub_ : dsub_;
+    kernels::dotColumns(
+        x + m * dsub_, get_tcentroids(m), ksub_, d, table + m * ksub_);
+  }
+}
+
+void ProductQuantizer::mulcodes_table(
+    const real* table,
+    const uint8_t* codes,
+    int64_t begin,
+    int64_t end,
+    real* out) const {
+  // 4 vectors are scored at once to hide the latency of the additions
+  int64_t t = begin;
+  for (; t + 4 <= end; t += 4) {
+    const uint8_t* code = codes + nsubq_ * t;
+    real res0 = 0.0, res1 = 0.0, res2 = 0.0, res3 = 0.0;
+    for (auto m = 0; m < nsubq_; m++) {
+      const real* row = table + m * ksub_;
+      res0 += row[code[m]];
+      res1 += row[code[nsubq_ + m]];
+      res2 += row[code[2 * nsubq_ + m]];
+      res3 += row[code[3 * nsubq_ + m]];
+    }
+    out[t] = res0;
+    out[t + 1] = res1;
+    out[t + 2] = res2;
+    out[t + 3] = res3;
+  }
+  for (; t < end; t++) {
+    const uint8_t* code = codes + nsubq_ * t;
+    real res = 0.0;
+    for (auto m = 0; m < nsubq_; m++) {
+      res += table[m * ksub_ + code[m]];
+    }
+    out[t] = res;
+  }
+}
+
 void ProductQuantizer::addcode(
     Vector& x,
     const uint8_t* codes,
@@ -222,11 +306,20 @@ void ProductQuantizer::compute_code(const real* x, uint8_t* code) const {
   }
 }
 
-void ProductQuantizer::compute_codes(const real* x, uint8_t* codes, int32_t n)
-    const {
-  for (auto i = 0; i < n; i++) {
-    compute_code(x + i * dim_, codes + i * nsubq_);
-  }
+void ProductQuantizer::compute_codes(
+    const real* x,
+    uint8_t* codes,
+    int32_t n,
+    int32_t nthreads) const {
+  utils::parallelFor(n, nthreads, [&](int64_t begin, int64_t end) {
+    for (auto i = begin; i < end; i++) {
+      for (auto m = 0; m < nsubq_; m++) {
+        auto d = (m == nsubq_ - 1) ? lastdsub_ : dsub_;
+        codes[i * nsubq_ + m] = (uint8_t)kernels::nearestL2(
+            x + i * dim_ + m * dsub_, get_tcentroids(m), ksub_, d);
+      }
+    }
+  });
 }
 
 void ProductQuantizer::save(std::ostream& out) const {
@@ -246,6 +339,7 @@ void ProductQuantizer::load(std::istream& in) {
   for (auto i = 0; i < centroids_.size(); i++) {
     in.read((char*)&centroids_[i], sizeof(real));
   }
+  transpose_centroids();
 }
 
 } // namespace fasttext
@@ -35,6 +35,9 @@ class ProductQuantizer {
   int32_t lastdsub_;
 
   std::vector<real> centroids_;
+  // the centroids of each sub-quantizer as the columns of a d x ksub_ matrix,
+  // for the vectorized kernels (see transpose_centroids)
+  std::vector<real> tcentroids_;
 
   std::minstd_rand rng;
 
@@ -44,17 +47,38 @@ class ProductQuantizer {
 
   real* get_centroids(int32_t, uint8_t);
   const real* get_centroids(int32_t, uint8_t) const;
+  const real* get_tcentroids(int32_t) const;
+  void transpose_centroids();
 
   real assign_centroid(const real*, const real*, uint8_t*, int32_t) const;
-  void Estep(const real*, const real*, uint8_t*, int32_t, int32_t) const;
+  // The points are split between nthreads threads, each one computing the
+  // distances of a point to all the centroids at once (see
+  // kernels::nearestL2): codes are the same as with assign_centroid.
+  void Estep(
+      const real*,
+      const real*,
+      uint8_t*,
+      int32_t,
+      int32_t,
+      int32_t nthreads = 1) const;
   void MStep(const real*, real*, const uint8_t*, int32_t, int32_t);
-  void kmeans(const real*, real*, int32_t, int32_t);
-  void train(int, const real*);
+  void kmeans(const real*, real*, int32_t, int32_t, int32_t nthreads = 1);
+  void train(int, const real*, int32_t nthreads = 1);
 
   real mulcode(const Vector&, const uint8_t*, int32_t, real) const;
+  // table[m * ksub_ + j] is the dot product of the m-th sub-vector of x with
+  // the centroid j of the m-th sub-quantizer: the dot product of x with any
+  // coded vector is then nsubq_ lookups (see mulcodes_table).
+  int64_t table_size() const;
+  void compute_table(const real*, real*) const;
+  // out[t] is the dot product of the coded vector t with the vector of the
+  // table, for begin <= t < end
+  void mulcodes_table(const real*, const uint8_t*, int64_t, int64_t, real*)
+      const;
   void addcode(Vector&, const uint8_t*, int32_t, real) const;
   void compute_code(const real*, uint8_t*) const;
-  void compute_codes(const real*, uint8_t*, int32_t) const;
+  void compute_codes(const real*, uint8_t*, int32_t, int32_t nthreads = 1)
+      const;
 
   void save(std::ostream&) const;
   void load(std::istream&);
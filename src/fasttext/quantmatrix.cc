@@ -9,55 +9,116 @@
 #include "quantmatrix.h"
 
 #include <assert.h>
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 
 namespace fasttext {
 
-QuantMatrix::QuantMatrix() : Matrix(), qnorm_(false), codesize_(0) {}
+QuantMatrix::QuantMatrix()
+    : Matrix(),
+      file_(nullptr),
+      codesptr_(nullptr),
+      normcodesptr_(nullptr),
+      qnorm_(false),
+      codesize_(0) {}
 
-QuantMatrix::QuantMatrix(DenseMatrix&& mat, int32_t dsub, bool qnorm)
+QuantMatrix::QuantMatrix(std::shared_ptr<const MappedFile> file)
+    : QuantMatrix() {
+  file_ = file;
+}
+
+QuantMatrix::QuantMatrix(
+    DenseMatrix&& mat,
+    int32_t dsub,
+    bool qnorm,
+    int32_t nthreads)
     : Matrix(mat.size(0), mat.size(1)),
+      file_(nullptr),
+      codesptr_(nullptr),
+      normcodesptr_(nullptr),
       qnorm_(qnorm),
       codesize_(mat.size(0) * ((mat.size(1) + dsub - 1) / dsub)) {
   codes_.resize(codesize_);
+  codesptr_ = codes_.data();
   pq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer(n_, dsub));
   if (qnorm_) {
     norm_codes_.resize(m_);
+    normcodesptr_ = norm_codes_.data();
     npq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer(1, 1));
   }
-  quantize(std::forward<DenseMatrix>(mat));
+  quantize(std::forward<DenseMatrix>(mat), nthreads);
 }
 
-void QuantMatrix::quantizeNorm(const Vector& norms) {
+void QuantMatrix::quantizeNorm(const Vector& norms, int32_t nthreads) {
   assert(qnorm_);
   assert(norms.size() == m_);
   auto dataptr = norms.data();
-  npq_->train(m_, dataptr);
-  npq_->compute_codes(dataptr, norm_codes_.data(), m_);
+  npq_->train(m_, dataptr, nthreads);
+  npq_->compute_codes(dataptr, norm_codes_.data(), m_, nthreads);
 }
 
-void QuantMatrix::quantize(DenseMatrix&& mat) {
+void QuantMatrix::quantize(DenseMatrix&& mat, int32_t nthreads) {
   if (qnorm_) {
     Vector norms(mat.size(0));
     mat.l2NormRow(norms);
     mat.divideRow(norms);
-    quantizeNorm(norms);
+    quantizeNorm(norms, nthreads);
   }
   auto dataptr = mat.data();
-  pq_->train(m_, dataptr);
-  pq_->compute_codes(dataptr, codes_.data(), m_);
+  pq_->train(m_, dataptr, nthreads);
+  pq_->compute_codes(dataptr, codes_.data(), m_, nthreads);
 }
 
 real QuantMatrix::dotRow(const Vector& vec, int64_t i) const {
   assert(i >= 0);
   assert(i < m_);
   assert(vec.size() == n_);
-  real norm = 1;
+  return pq_->mulcode(vec, codesptr_, i, norm(i));
+}
+
+real QuantMatrix::norm(int64_t i) const {
+  if (qnorm_) {
+    return npq_->get_centroids(0, normcodesptr_[i])[0];
+  }
+  return 1;
+}
+
+void QuantMatrix::dotRowsTable(
+    const real* table,
+    int64_t begin,
+    int64_t end,
+    real* out) const {
+  pq_->mulcodes_table(table, codesptr_, begin, end, out);
   if (qnorm_) {
-    norm = npq_->get_centroids(0, norm_codes_[i])[0];
+    for (int64_t i = begin; i < end; i++) {
+      out[i] *= norm(i);
+    }
+  }
+}
+
+void QuantMatrix::dotRows(const Vector& vec, Vector& out) const {
+  assert(vec.size() == n_);
+  assert(out.size() == m_);
+  std::vector<real> table(pq_->table_size());
+  pq_->compute_table(vec.data(), table.data());
+  dotRowsTable(table.data(), 0, m_, out.data());
+}
+
+void QuantMatrix::dotRows(const real* x, int64_t m, real* out) const {
+  const int64_t tableSize = pq_->table_size();
+  std::vector<real> tables(m * tableSize);
+  for (int64_t i = 0; i < m; i++) {
+    pq_->compute_table(x + i * n_, tables.data() + i * tableSize);
+  }
+  // the codes of a tile of rows stay in the cache for all the vectors
+  const int64_t tileRows = 256;
+  for (int64_t j = 0; j < m_; j += tileRows) {
+    const int64_t end = std::min(m_, j + tileRows);
+    for (int64_t i = 0; i < m; i++) {
+      dotRowsTable(tables.data() + i * tableSize, j, end, out + i * m_);
+    }
   }
-  return pq_->mulcode(vec, codes_.data(), i, norm);
 }
 
 void QuantMatrix::addVectorToRow(const Vector&, int64_t, real) {
@@ -65,19 +126,11 @@ void QuantMatrix::addVectorToRow(const Vector&, int64_t, real) {
 }
 
 void QuantMatrix::addRowToVector(Vector& x, int32_t i, real a) const {
-  real norm = 1;
-  if (qnorm_) {
-    norm = npq_->get_centroids(0, norm_codes_[i])[0];
-  }
-  pq_->addcode(x, codes_.data(), i, a * norm);
+  pq_->addcode(x, codesptr_, i, a * norm(i));
 }
 
 void QuantMatrix::addRowToVector(Vector& x, int32_t i) const {
-  real norm = 1;
-  if (qnorm_) {
-    norm = npq_->get_centroids(0, norm_codes_[i])[0];
-  }
-  pq_->addcode(x, codes_.data(), i, norm);
+  pq_->addcode(x, codesptr_, i, norm(i));
 }
 
 void QuantMatrix::save(std::ostream& out) const {
@@ -85,10 +138,10 @@ void QuantMatrix::save(std::ostream& out) const {
   out.write((char*)&m_, sizeof(m_));
   out.write((char*)&n_, sizeof(n_));
   out.write((char*)&codesize_, sizeof(codesize_));
-  out.write((char*)codes_.data(), codesize_ * sizeof(uint8_t));
+  out.write((char*)codesptr_, codesize_ * sizeof(uint8_t));
   pq_->save(out);
   if (qnorm_) {
-    out.write((char*)norm_codes_.data(), m_ * sizeof(uint8_t));
+    out.write((char*)normcodesptr_, m_ * sizeof(uint8_t));
     npq_->save(out);
   }
 }
@@ -98,18 +151,34 @@ void QuantMatrix::load(std::istream& in) {
   in.read((char*)&m_, sizeof(m_));
   in.read((char*)&n_, sizeof(n_));
   in.read((char*)&codesize_, sizeof(codesize_));
-  codes_ = std::vector<uint8_t>(codesize_);
-  in.read((char*)codes_.data(), codesize_ * sizeof(uint8_t));
+  codesptr_ = loadCodes(in, codes_, codesize_);
   pq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer());
   pq_->load(in);
   if (qnorm_) {
-    norm_codes_ = std::vector<uint8_t>(m_);
-    in.read((char*)norm_codes_.data(), m_ * sizeof(uint8_t));
+    normcodesptr_ = loadCodes(in, norm_codes_, m_);
     npq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer());
     npq_->load(in);
   }
 }
 
+const uint8_t* QuantMatrix::loadCodes(
+    std::istream& in,
+    std::vector<uint8_t>& codes,
+    int64_t n) const {
+  if (!file_) {
+    codes = std::vector<uint8_t>(n);
+    in.read((char*)codes.data(), n * sizeof(uint8_t));
+    return codes.data();
+  }
+  const int64_t offset = in.tellg();
+  if (!in || n < 0 || offset + n > file_->size()) {
+    throw std::invalid_argument("Model file is truncated.");
+  }
+  codes.clear();
+  in.seekg(n * sizeof(uint8_t), std::ios_base::cur);
+  return reinterpret_cast<const uint8_t*>(file_->data() + offset);
+}
+
 void QuantMatrix::dump(std::ostream&) const {
   throw std::runtime_error("Operation not permitted on quantized matrices.");
 }
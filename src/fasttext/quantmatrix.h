@@ -18,6 +18,7 @@
 #include "real.h"
 
 #include "densematrix.h"
+#include "mappedfile.h"
 #include "matrix.h"
 #include "vector.h"
 
@@ -33,22 +34,45 @@ class QuantMatrix : public Matrix {
   std::vector<uint8_t> codes_;
   std::vector<uint8_t> norm_codes_;
 
+  // codes are read from these pointers: they point either to the vectors
+  // above or, for a memory mapped model, directly into the file
+  std::shared_ptr<const MappedFile> file_;
+  const uint8_t* codesptr_;
+  const uint8_t* normcodesptr_;
+
   bool qnorm_;
   int32_t codesize_;
 
+  real norm(int64_t i) const;
+  void dotRowsTable(
+      const real* table,
+      int64_t begin,
+      int64_t end,
+      real* out) const;
+
+  const uint8_t*
+  loadCodes(std::istream& in, std::vector<uint8_t>& codes, int64_t n) const;
+
  public:
   QuantMatrix();
-  QuantMatrix(DenseMatrix&&, int32_t, bool);
+  explicit QuantMatrix(std::shared_ptr<const MappedFile> file);
+  // the product quantizers are trained and applied by nthreads threads
+  QuantMatrix(DenseMatrix&&, int32_t, bool, int32_t nthreads = 1);
   QuantMatrix(const QuantMatrix&) = delete;
   QuantMatrix(QuantMatrix&&) = delete;
   QuantMatrix& operator=(const QuantMatrix&) = delete;
   QuantMatrix& operator=(QuantMatrix&&) = delete;
   virtual ~QuantMatrix() noexcept override = default;
 
-  void quantizeNorm(const Vector&);
-  void quantize(DenseMatrix&& mat);
+  void quantizeNorm(const Vector&, int32_t nthreads = 1);
+  void quantize(DenseMatrix&& mat, int32_t nthreads = 1);
 
   real dotRow(const Vector&, int64_t) const override;
+  // scores of all the rows from a table of the products of the vector with
+  // the centroids (see ProductQuantizer::compute_table), built once per
+  // vector: equal to dotRow up to the order of the additions
+  void dotRows(const Vector&, Vector& out) const override;
+  void dotRows(const real* x, int64_t m, real* out) const override;
   void addVectorToRow(const Vector&, int64_t, real) override;
   void addRowToVector(Vector& x, int32_t i) const override;
   void addRowToVector(Vector& x, int32_t i, real a) const override;
@@ -8,8 +8,10 @@
 
 #include "utils.h"
 
+#include <exception>
 #include <iomanip>
 #include <ios>
+#include <thread>
 
 namespace fasttext {
 
@@ -25,6 +27,35 @@ void seek(std::ifstream& ifs, int64_t pos) {
   ifs.seekg(std::streampos(pos));
 }
 
+void parallelFor(
+    int64_t n,
+    int32_t nthreads,
+    const std::function<void(int64_t, int64_t)>& f) {
+  if (nthreads <= 1) {
+    f(0, n);
+    return;
+  }
+  std::vector<std::exception_ptr> errors(nthreads);
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < nthreads; i++) {
+    threads.push_back(std::thread([&, i]() {
+      try {
+        f(i * n / nthreads, (i + 1) * n / nthreads);
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    }));
+  }
+  for (int32_t i = 0; i < nthreads; i++) {
+    threads[i].join();
+  }
+  for (int32_t i = 0; i < nthreads; i++) {
+    if (errors[i]) {
+      std::rethrow_exception(errors[i]);
+    }
+  }
+}
+
 double getDuration(
     const std::chrono::steady_clock::time_point& start,
     const std::chrono::steady_clock::time_point& end) {
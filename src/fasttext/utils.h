@@ -13,6 +13,7 @@
 #include <algorithm>
 #include <chrono>
 #include <fstream>
+#include <functional>
 #include <ostream>
 #include <vector>
 
@@ -40,6 +41,13 @@ bool contains(const std::vector<T>& container, const T& value) {
       container.end();
 }
 
+// runs f(begin, end) on nthreads consecutive ranges of [0, n), one thread
+// each, and rethrows the first exception of a thread
+void parallelFor(
+    int64_t n,
+    int32_t nthreads,
+    const std::function<void(int64_t, int64_t)>& f);
+
 double getDuration(
     const std::chrono::steady_clock::time_point& start,
     const std::chrono::steady_clock::time_point& end);
@@ -13,6 +13,7 @@
 #include <cmath>
 #include <iomanip>
 
+#include "kernels.h"
 #include "matrix.h"
 
 namespace fasttext {
@@ -24,31 +25,21 @@ void Vector::zero() {
 }
 
 real Vector::norm() const {
-  real sum = 0;
-  for (int64_t i = 0; i < size(); i++) {
-    sum += data_[i] * data_[i];
-  }
-  return std::sqrt(sum);
+  return std::sqrt(kernels::dot(data_.data(), data_.data(), size()));
 }
 
 void Vector::mul(real a) {
-  for (int64_t i = 0; i < size(); i++) {
-    data_[i] *= a;
-  }
+  kernels::scale(data_.data(), a, size());
 }
 
 void Vector::addVector(const Vector& source) {
   assert(size() == source.size());
-  for (int64_t i = 0; i < size(); i++) {
-    data_[i] += source.data_[i];
-  }
+  kernels::add(data_.data(), source.data_.data(), size());
 }
 
 void Vector::addVector(const Vector& source, real s) {
   assert(size() == source.size());
-  for (int64_t i = 0; i < size(); i++) {
-    data_[i] += s * source.data_[i];
-  }
+  kernels::addScaled(data_.data(), source.data_.data(), s, size());
 }
 
 void Vector::addRow(const Matrix& A, int64_t i, real a) {
@@ -68,9 +59,7 @@ void Vector::addRow(const Matrix& A, int64_t i) {
 void Vector::mul(const Matrix& A, const Vector& vec) {
   assert(A.size(0) == size());
   assert(A.size(1) == vec.size());
-  for (int64_t i = 0; i < size(); i++) {
-    data_[i] = A.dotRow(vec, i);
-  }
+  A.dotRows(vec, *this);
 }
 
 int64_t Vector::argmax() {
@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "wordtable.h"
+
+#include <cstring>
+
+namespace fasttext {
+
+namespace {
+
+constexpr size_t kMinSlots = 16;
+
+// number of slots (a power of two) to hold n words at a load of at most 0.7
+size_t slotsFor(size_t n) {
+  size_t nslots = kMinSlots;
+  while (n * 10 > nslots * 7) {
+    nslots *= 2;
+  }
+  return nslots;
+}
+
+} // namespace
+
+WordTable::WordTable() : offsets_(1, 0) {}
+
+int32_t WordTable::find(const TextSpan& word, uint32_t h) const {
+  if (slots_.empty()) {
+    return -1;
+  }
+  const size_t mask = slots_.size() - 1;
+  for (size_t i = h & mask;; i = (i + 1) & mask) {
+    const Slot& slot = slots_[i];
+    if (slot.id < 0) {
+      return -1;
+    }
+    if (slot.hash == h) {
+      const int64_t begin = offsets_[slot.id];
+      if (size_t(offsets_[slot.id + 1] - begin) == word.size &&
+          std::memcmp(chars_.data() + begin, word.data, word.size) == 0) {
+        return slot.id;
+      }
+    }
+  }
+}
+
+int32_t WordTable::insert(const TextSpan& word, uint32_t h) {
+  const int32_t id = size();
+  const size_t nslots = slotsFor(id + 1);
+  if (nslots > slots_.size()) {
+    rehash(nslots);
+  }
+  chars_.insert(chars_.end(), word.data, word.data + word.size);
+  offsets_.push_back(chars_.size());
+  hashes_.push_back(h);
+  const size_t mask = slots_.size() - 1;
+  size_t i = h & mask;
+  while (slots_[i].id >= 0) {
+    i = (i + 1) & mask;
+  }
+  slots_[i].hash = h;
+  slots_[i].id = id;
+  return id;
+}
+
+void WordTable::rehash(size_t nslots) {
+  slots_.assign(nslots, Slot{0, -1});
+  const size_t mask = nslots - 1;
+  for (int32_t id = 0; id < size(); id++) {
+    size_t i = hashes_[id] & mask;
+    while (slots_[i].id >= 0) {
+      i = (i + 1) & mask;
+    }
+    slots_[i].hash = hashes_[id];
+    slots_[i].id = id;
+  }
+}
+
+void WordTable::reserve(int32_t nwords, int64_t nchars) {
+  hashes_.reserve(nwords);
+  offsets_.reserve(nwords + 1);
+  chars_.reserve(nchars);
+  const size_t nslots = slotsFor(nwords);
+  if (nslots > slots_.size()) {
+    rehash(nslots);
+  }
+}
+
+void WordTable::clear() {
+  slots_.clear();
+  chars_.clear();
+  offsets_.assign(1, 0);
+  hashes_.clear();
+}
+
+} // namespace fasttext
@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace fasttext {
+
+// Characters of a buffer owned by someone else, not necessarily null
+// terminated.
+struct TextSpan {
+  const char* data;
+  size_t size;
+};
+
+// Words of a vocabulary, numbered in insertion order. The characters of all
+// the words are packed in a single buffer and ids are found with an open
+// addressing hash table sized to the vocabulary, each slot storing the hash
+// of its word beside its id: probing only compares the strings of the words
+// with the same hash.
+class WordTable {
+ protected:
+  struct Slot {
+    uint32_t hash;
+    int32_t id;
+  };
+
+  // power of two, id is -1 for an empty slot
+  std::vector<Slot> slots_;
+  std::vector<char> chars_;
+  // word i is [offsets_[i], offsets_[i + 1]) of chars_
+  std::vector<int64_t> offsets_;
+  std::vector<uint32_t> hashes_;
+
+  void rehash(size_t nslots);
+
+ public:
+  WordTable();
+
+  inline int32_t size() const {
+    return hashes_.size();
+  }
+  inline TextSpan word(int32_t id) const {
+    return TextSpan{chars_.data() + offsets_[id],
+                    size_t(offsets_[id + 1] - offsets_[id])};
+  }
+  inline uint32_t hash(int32_t id) const {
+    return hashes_[id];
+  }
+
+  // id of the word of hash h, -1 if it is not in the table
+  int32_t find(const TextSpan& word, uint32_t h) const;
+  // adds a word which is not in the table yet, its id is the previous size
+  int32_t insert(const TextSpan& word, uint32_t h);
+  void reserve(int32_t nwords, int64_t nchars);
+  void clear();
+};
+
+} // namespace fasttext